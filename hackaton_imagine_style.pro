@@ -6,18 +6,14 @@ CONFIG += c++11
 # In order to do so, uncomment the following line.
 #DEFINES += QT_DISABLE_DEPRECATED_BEFORE=0x060000    # disables all the APIs deprecated before Qt 6.0.0
 
+include(imaginestyle.pri)
+
 SOURCES += \
     main.cpp \
-    mainwindow.cpp \
-    ninepatch.cpp \
-    qimaginestyle.cpp
+    mainwindow.cpp
 
 HEADERS += \
-    mainwindow.h \
-    ninepatch.h \
-    qimaginestyle.h
+    mainwindow.h
 
 FORMS += \
     mainwindow.ui
-
-RESOURCES += $$PWD/images
@@ -0,0 +1,196 @@
+#include "imaginediskcache.h"
+
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QLoggingCategory>
+#include <QRunnable>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QThreadPool>
+
+// Defined in qimaginestyle.cpp
+Q_DECLARE_LOGGING_CATEGORY(lcImagineStyle)
+
+static const quint32 cacheMagic = 0x51494d43; // "QIMC"
+
+// Bump whenever the layout of the file, or the way assets are decoded or rendered, changes
+static const quint32 cacheVersion = 2;
+
+static bool isCacheableFormat(QImage::Format format)
+{
+    return format == QImage::Format_ARGB32_Premultiplied
+            || format == QImage::Format_ARGB32
+            || format == QImage::Format_RGB32;
+}
+
+static void writeImage(QDataStream &stream, const QImage &image)
+{
+    stream << qint32(image.width()) << qint32(image.height()) << qint32(image.format())
+           << qint32(image.bytesPerLine()) << double(image.devicePixelRatio());
+    stream.writeRawData(reinterpret_cast<const char *>(image.constBits()), int(image.sizeInBytes()));
+}
+
+static QImage readImage(QDataStream &stream)
+{
+    qint32 width, height, format, bytesPerLine;
+    double dpr;
+    stream >> width >> height >> format >> bytesPerLine >> dpr;
+    if (stream.status() != QDataStream::Ok || width <= 0 || height <= 0
+            || !isCacheableFormat(QImage::Format(format))) {
+        return QImage();
+    }
+
+    // Read the pixels straight into the image, this is what saves us from decoding the PNG
+    QImage image(width, height, QImage::Format(format));
+    if (image.isNull() || image.bytesPerLine() != bytesPerLine)
+        return QImage();
+    if (stream.readRawData(reinterpret_cast<char *>(image.bits()), int(image.sizeInBytes())) != int(image.sizeInBytes()))
+        return QImage();
+    image.setDevicePixelRatio(dpr);
+    return image;
+}
+
+namespace {
+
+class DiskCacheWriter : public QRunnable
+{
+public:
+    DiskCacheWriter(const QString &filePath, const QByteArray &contentHash, const QVector<QImagineDiskCache::Entry> &entries)
+        : m_filePath(filePath)
+        , m_contentHash(contentHash)
+        , m_entries(entries)
+    {
+    }
+
+    void run() override
+    {
+        QDir().mkpath(QFileInfo(m_filePath).absolutePath());
+        QSaveFile file(m_filePath);
+        if (!file.open(QIODevice::WriteOnly)) {
+            qCWarning(lcImagineStyle) << "disk cache, cannot write:" << m_filePath;
+            return;
+        }
+
+        QDataStream stream(&file);
+        stream.setVersion(QDataStream::Qt_5_6);
+        stream << cacheMagic << cacheVersion << m_contentHash;
+
+        QVector<QImagineDiskCache::Entry> entries;
+        for (const auto &entry : qAsConst(m_entries)) {
+            if (isCacheableFormat(entry.image.format()))
+                entries.append(entry);
+        }
+
+        stream << quint32(entries.size());
+        for (const auto &entry : qAsConst(entries)) {
+            stream << entry.fileName << entry.render;
+            writeImage(stream, entry.image);
+        }
+
+        if (stream.status() != QDataStream::Ok || !file.commit())
+            qCWarning(lcImagineStyle) << "disk cache, failed to write:" << m_filePath;
+    }
+
+private:
+    QString m_filePath;
+    QByteArray m_contentHash;
+    QVector<QImagineDiskCache::Entry> m_entries;
+};
+
+} // namespace
+
+QImagineDiskCache::QImagineDiskCache(const QString &imagePath, const QStringList &fileNames, int options)
+{
+    QStringList sortedFileNames = fileNames;
+    sortedFileNames.sort();
+
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    hash.addData(reinterpret_cast<const char *>(&options), sizeof(options));
+    for (const QString &fileName : qAsConst(sortedFileNames)) {
+        QFile file(fileName);
+        if (!file.open(QIODevice::ReadOnly))
+            continue;
+        hash.addData(fileName.toUtf8());
+        hash.addData(file.readAll());
+    }
+    m_contentHash = hash.result();
+
+    // One file per image path, so that applications with different themes don't compete
+    const QByteArray pathHash = QCryptographicHash::hash(imagePath.toUtf8(), QCryptographicHash::Sha1).toHex().left(16);
+    m_filePath = QStandardPaths::writableLocation(QStandardPaths::CacheLocation)
+            + QStringLiteral("/imaginestyle-") + QString::fromLatin1(pathHash) + QStringLiteral(".cache");
+
+    m_valid = load();
+    if (!m_valid)
+        clear();
+}
+
+bool QImagineDiskCache::load()
+{
+    QFile file(m_filePath);
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+
+    QDataStream stream(&file);
+    stream.setVersion(QDataStream::Qt_5_6);
+
+    quint32 magic, version;
+    QByteArray contentHash;
+    stream >> magic >> version;
+    if (stream.status() != QDataStream::Ok || magic != cacheMagic || version != cacheVersion)
+        return false;
+    stream >> contentHash;
+    if (contentHash != m_contentHash)
+        return false;
+
+    quint32 count;
+    stream >> count;
+    for (quint32 i = 0; i < count; ++i) {
+        QString fileName;
+        bool render;
+        stream >> fileName >> render;
+        const QImage image = readImage(stream);
+        if (image.isNull())
+            return false;
+        if (render)
+            m_renders[fileName].append(image);
+        else
+            m_assets.insert(fileName, image);
+    }
+    return stream.status() == QDataStream::Ok;
+}
+
+bool QImagineDiskCache::isValid() const
+{
+    return m_valid;
+}
+
+QStringList QImagineDiskCache::assetFileNames() const
+{
+    return m_assets.keys();
+}
+
+QImage QImagineDiskCache::asset(const QString &fileName) const
+{
+    return m_assets.value(fileName);
+}
+
+QHash<QString, QVector<QImage>> QImagineDiskCache::renders() const
+{
+    return m_renders;
+}
+
+void QImagineDiskCache::clear()
+{
+    m_assets.clear();
+    m_renders.clear();
+}
+
+void QImagineDiskCache::save(const QVector<Entry> &entries, QThreadPool *pool) const
+{
+    pool->start(new DiskCacheWriter(m_filePath, m_contentHash, entries));
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <QHash>
+#include <QImage>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+class QThreadPool;
+
+// Keeps decoded assets, and the nine-patch renders that were used the most, in a single file
+// under the user cache directory. The file is only used when it was written by the same cache
+// version from the very same set of assets (by content) and style options.
+class QImagineDiskCache
+{
+public:
+    struct Entry {
+        QString fileName;
+        QImage image;
+        bool render;
+    };
+
+    QImagineDiskCache(const QString &imagePath, const QStringList &fileNames, int options);
+
+    bool isValid() const;
+    QStringList assetFileNames() const;
+    QImage asset(const QString &fileName) const;
+    QHash<QString, QVector<QImage>> renders() const;
+
+    // Drops what was read from the file, once it has been handed over
+    void clear();
+
+    // Replaces the file with the entries. The file is written from a task on the pool.
+    void save(const QVector<Entry> &entries, QThreadPool *pool) const;
+
+private:
+    bool load();
+
+    QString m_filePath;
+    QByteArray m_contentHash;
+    QHash<QString, QImage> m_assets;
+    QHash<QString, QVector<QImage>> m_renders;
+    bool m_valid = false;
+};
@@ -0,0 +1,259 @@
+#include "imagineelements.h"
+
+#include <algorithm>
+
+#include <QAbstractSpinBox>
+#include <QStyleOption>
+
+using Rule = QImagineElementRule;
+using Asset = QImagineAsset;
+
+// Every element that the style draws with assets. Adding a family is adding a line here; the
+// states come from the option, and whichever states the family has assets for are used. The
+// last columns say how the asset sizes the control, and where the part lies in it.
+static const QImagineElementRule elementRules[] = {
+    { Rule::Primitive, QStyle::PE_IndicatorCheckBox, QStyle::SC_None, "checkbox-indicator", Rule::OptionRect, Asset::NoState, Asset::NoState, Rule::NaturalSize, QStyle::CT_CheckBox, Rule::AssetSize, Rule::BaseAlignment },
+    { Rule::Primitive, QStyle::PE_IndicatorRadioButton, QStyle::SC_None, "radiobutton-indicator", Rule::OptionRect, Asset::NoState, Asset::NoState, Rule::NaturalSize, QStyle::CT_RadioButton, Rule::AssetSize, Rule::BaseAlignment },
+    { Rule::Primitive, QStyle::PE_PanelLineEdit, QStyle::SC_None, "textfield-background", Rule::OptionRect, Asset::NoState, Asset::NoState, Rule::SkipFrameless, QStyle::CT_LineEdit, Rule::AssetSize, Rule::BaseAlignment },
+    { Rule::Primitive, QStyle::PE_PanelButtonTool, QStyle::SC_None, "toolbutton-background", Rule::OptionRect, Asset::NoState, Asset::NoState, Rule::NoFlags, QStyle::CT_ToolButton, Rule::AssetSize, Rule::BaseAlignment },
+    { Rule::Primitive, QStyle::PE_PanelMenu, QStyle::SC_None, "menu-background", Rule::OptionRect, Asset::NoState, Asset::NoState, Rule::NoFlags, -1, Rule::NoSizing, Rule::BaseAlignment },
+    { Rule::Primitive, QStyle::PE_PanelTipLabel, QStyle::SC_None, "tooltip-background", Rule::OptionRect, Asset::NoState, Asset::NoState, Rule::NoFlags, -1, Rule::NoSizing, Rule::BaseAlignment },
+    { Rule::Primitive, QStyle::PE_FrameTabBarBase, QStyle::SC_None, "tabbar-background", Rule::OptionRect, Asset::NoState, Asset::NoState, Rule::NoFlags, -1, Rule::NoSizing, Rule::BaseAlignment },
+    { Rule::Primitive, QStyle::PE_PanelItemViewItem, QStyle::SC_None, "itemdelegate-background", Rule::OptionRect, Asset::NoState, Asset::Highlighted, Rule::NoFlags, QStyle::CT_ItemViewItem, Rule::AssetThickness, Rule::BaseAlignment },
+    { Rule::Primitive, QStyle::PE_IndicatorItemViewItemCheck, QStyle::SC_None, "checkdelegate-indicator", Rule::OptionRect, Asset::NoState, Asset::NoState, Rule::NaturalSize, -1, Rule::NoSizing, Rule::BaseAlignment },
+
+    { Rule::Control, QStyle::CE_PushButtonBevel, QStyle::SC_None, "button-background-flat", Rule::OptionRect, Asset::NoState, Asset::NoState, Rule::FlatButtonOnly, QStyle::CT_PushButton, Rule::AssetSize, Rule::BaseAlignment },
+    { Rule::Control, QStyle::CE_PushButtonBevel, QStyle::SC_None, "button-background", Rule::OptionRect, Asset::NoState, Asset::NoState, Rule::NoFlags, QStyle::CT_PushButton, Rule::AssetSize, Rule::BaseAlignment },
+    { Rule::Control, QStyle::CE_TabBarTabShape, QStyle::SC_None, "tabbutton-background", Rule::OptionRect, Asset::NoState, Asset::Checked, Rule::NoFlags, QStyle::CT_TabBarTab, Rule::AssetSize, Rule::BaseAlignment },
+    { Rule::Control, QStyle::CE_MenuItem, QStyle::SC_None, "menuitem-background", Rule::OptionRect, Asset::NoState, Asset::Highlighted, Rule::KeepBasePart, QStyle::CT_MenuItem, Rule::AssetThickness, Rule::BaseAlignment },
+    { Rule::Control, QStyle::CE_ToolBar, QStyle::SC_None, "toolbar-background", Rule::OptionRect, Asset::NoState, Asset::NoState, Rule::NoFlags, -1, Rule::NoSizing, Rule::BaseAlignment },
+    { Rule::Control, QStyle::CE_ProgressBarGroove, QStyle::SC_None, "progressbar-background", Rule::OptionRect, Asset::NoState, Asset::NoState, Rule::NoFlags, QStyle::CT_ProgressBar, Rule::AssetThickness, Rule::BaseAlignment },
+    { Rule::Control, QStyle::CE_ProgressBarContents, QStyle::SC_None, "progressbar-progress", Rule::ValueProgress, Asset::NoState, Asset::NoState, Rule::NoFlags, -1, Rule::NoSizing, Rule::BaseAlignment },
+    { Rule::Control, QStyle::CE_Splitter, QStyle::SC_None, "splitview-handle", Rule::OptionRect, Asset::NoState, Asset::NoState, Rule::NoFlags, -1, Rule::NoSizing, Rule::BaseAlignment },
+
+    { Rule::ComplexControl, QStyle::CC_Slider, QStyle::SC_SliderGroove, "slider-background", Rule::OptionRect, Asset::NoState, Asset::NoState, Rule::NoFlags, QStyle::CT_Slider, Rule::AssetThickness, Rule::BaseAlignment },
+    { Rule::ComplexControl, QStyle::CC_Slider, QStyle::SC_SliderGroove, "slider-progress", Rule::ValueProgress, Asset::NoState, Asset::NoState, Rule::OptionalPart, -1, Rule::NoSizing, Rule::BaseAlignment },
+    { Rule::ComplexControl, QStyle::CC_Slider, QStyle::SC_SliderHandle, "slider-handle", Rule::PartRect, Asset::NoState, Asset::NoState, Rule::ActivePartOnly | Rule::NaturalSize, QStyle::CT_Slider, Rule::AssetThickness, Rule::Centered },
+    { Rule::ComplexControl, QStyle::CC_ComboBox, QStyle::SC_ComboBoxFrame, "combobox-background", Rule::OptionRect, Asset::NoState, Asset::NoState, Rule::NoFlags, QStyle::CT_ComboBox, Rule::AssetSize, Rule::BaseAlignment },
+    { Rule::ComplexControl, QStyle::CC_ComboBox, QStyle::SC_ComboBoxArrow, "combobox-indicator", Rule::PartRect, Asset::NoState, Asset::NoState, Rule::ActivePartOnly | Rule::NaturalSize, -1, Rule::NoSizing, Rule::AtEnd },
+    { Rule::ComplexControl, QStyle::CC_ComboBox, QStyle::SC_ComboBoxEditField, nullptr, Rule::OptionRect, Asset::NoState, Asset::NoState, Rule::NoFlags, -1, Rule::NoSizing, Rule::Remainder },
+    { Rule::ComplexControl, QStyle::CC_ComboBox, QStyle::SC_ComboBoxListBoxPopup, nullptr, Rule::OptionRect, Asset::NoState, Asset::NoState, Rule::NoFlags, -1, Rule::NoSizing, Rule::BaseAlignment },
+    { Rule::ComplexControl, QStyle::CC_SpinBox, QStyle::SC_SpinBoxFrame, "spinbox-background", Rule::OptionRect, Asset::Editable, Asset::NoState, Rule::NoFlags, QStyle::CT_SpinBox, Rule::AssetSize, Rule::BaseAlignment },
+    { Rule::ComplexControl, QStyle::CC_SpinBox, QStyle::SC_SpinBoxUp, "spinbox-indicator-up", Rule::PartRect, Asset::Editable, Asset::NoState, Rule::ActivePartOnly, -1, Rule::NoSizing, Rule::AtEnd },
+    { Rule::ComplexControl, QStyle::CC_SpinBox, QStyle::SC_SpinBoxDown, "spinbox-indicator-down", Rule::PartRect, Asset::Editable, Asset::NoState, Rule::ActivePartOnly, -1, Rule::NoSizing, Rule::AtStart },
+    { Rule::ComplexControl, QStyle::CC_SpinBox, QStyle::SC_SpinBoxEditField, nullptr, Rule::OptionRect, Asset::NoState, Asset::NoState, Rule::NoFlags, -1, Rule::NoSizing, Rule::Remainder },
+    { Rule::ComplexControl, QStyle::CC_ScrollBar, QStyle::SC_ScrollBarSlider, "scrollbar-handle", Rule::PartRect, Asset::Interactive, Asset::NoState, Rule::ActivePartOnly, QStyle::CT_ScrollBar, Rule::AssetThickness, Rule::BaseAlignment },
+    { Rule::ComplexControl, QStyle::CC_ScrollBar, QStyle::SC_ScrollBarGroove | QStyle::SC_ScrollBarAddPage | QStyle::SC_ScrollBarSubPage | QStyle::SC_ScrollBarFirst | QStyle::SC_ScrollBarLast, nullptr, Rule::OptionRect, Asset::NoState, Asset::NoState, Rule::NoFlags, -1, Rule::NoSizing, Rule::BaseAlignment },
+    { Rule::ComplexControl, QStyle::CC_GroupBox, QStyle::SC_GroupBoxFrame, "groupbox-background", Rule::PartRect, Asset::NoState, Asset::NoState, Rule::NoFlags, -1, Rule::NoSizing, Rule::BaseAlignment },
+    { Rule::ComplexControl, QStyle::CC_GroupBox, QStyle::SC_GroupBoxLabel, "groupbox-title", Rule::PartRect, Asset::NoState, Asset::NoState, Rule::KeepBasePart | Rule::OptionalPart, -1, Rule::NoSizing, Rule::BaseAlignment },
+};
+
+static const struct {
+    const char *name;
+    QImagineAsset::State state;
+} stateNames[] = {
+    { "hovered", Asset::Hovered },
+    { "focused", Asset::Focused },
+    { "highlighted", Asset::Highlighted },
+    { "partially-checked", Asset::PartiallyChecked },
+    { "checked", Asset::Checked },
+    { "open", Asset::Open },
+    { "pressed", Asset::Pressed },
+    { "disabled", Asset::Disabled },
+    { "interactive", Asset::Interactive },
+    { "mirrored", Asset::Mirrored },
+    { "editable", Asset::Editable },
+    { "horizontal", Asset::Horizontal },
+    { "vertical", Asset::Vertical },
+};
+
+static bool parseStates(const QString &assetName, int start, QImagineAsset::States *states)
+{
+    // "-checked-focused" -> Checked | Focused. Any other word means that the
+    // asset belongs to another family, like "button-background-flat".
+    int index = start;
+    while (index < assetName.length()) {
+        if (assetName.at(index) != QLatin1Char('-'))
+            return false;
+        ++index;
+        bool found = false;
+        for (const auto &stateName : stateNames) {
+            const QLatin1String name(stateName.name);
+            const int end = index + name.size();
+            if (assetName.midRef(index, name.size()) == name
+                    && (end == assetName.length() || assetName.at(end) == QLatin1Char('-'))) {
+                *states |= stateName.state;
+                index = end;
+                found = true;
+                break;
+            }
+        }
+        if (!found)
+            return false;
+    }
+    return true;
+}
+
+void QImagineElementMap::build(const QStringList &assetNames)
+{
+    m_families.clear();
+    m_contentsRules.clear();
+    for (auto &rules : m_rules)
+        rules.clear();
+
+    for (const QImagineElementRule &rule : elementRules) {
+        m_rules[rule.kind][rule.element].append(&rule);
+        if (rule.contents >= 0 && rule.sizing != QImagineElementRule::NoSizing)
+            m_contentsRules[rule.contents].append(&rule);
+        if (!rule.family)
+            continue;
+
+        const QString family = QLatin1String(rule.family);
+        if (m_families.contains(family))
+            continue;
+
+        QVector<Candidate> &candidates = m_families[family];
+        for (const QString &assetName : assetNames) {
+            QImagineAsset::States states;
+            if (assetName.startsWith(family) && parseStates(assetName, family.length(), &states))
+                candidates.append({ states, assetName });
+        }
+
+        // The highest ranked first, so that the first match is the best one
+        std::sort(candidates.begin(), candidates.end(), [](const Candidate &a, const Candidate &b) {
+            return rank(a.states) > rank(b.states);
+        });
+    }
+}
+
+// The states in the order that they win when no asset shows all of them, the way the image
+// selector of the Imagine style for Qt Quick scores them. The value of a control comes first:
+// the sets have no checked and disabled assets, and a disabled checkbox should still show its
+// check mark. Structural states only tell assets of the same look apart, and never win over
+// a visual state; a disabled spin box shows its disabled assets, not its editable ones.
+static const QImagineAsset::State statePriority[] = {
+    Asset::Checked,
+    Asset::PartiallyChecked,
+    Asset::Disabled,
+    Asset::Pressed,
+    Asset::Open,
+    Asset::Highlighted,
+    Asset::Focused,
+    Asset::Hovered,
+
+    Asset::Editable,
+    Asset::Interactive,
+    Asset::Horizontal,
+    Asset::Vertical,
+    Asset::Mirrored
+};
+
+int QImagineElementMap::rank(QImagineAsset::States states)
+{
+    const int count = int(sizeof(statePriority) / sizeof(statePriority[0]));
+    int result = 0;
+    for (int i = 0; i < count; ++i) {
+        if (states & statePriority[i])
+            result |= 1 << (count - 1 - i);
+    }
+    return result;
+}
+
+const QVector<const QImagineElementRule *> &QImagineElementMap::rules(QImagineElementRule::Kind kind, int element) const
+{
+    static const QVector<const QImagineElementRule *> noRules;
+    const auto it = m_rules[kind].constFind(element);
+    return it != m_rules[kind].constEnd() ? it.value() : noRules;
+}
+
+const QVector<const QImagineElementRule *> &QImagineElementMap::contentsRules(QStyle::ContentsType type) const
+{
+    static const QVector<const QImagineElementRule *> noRules;
+    const auto it = m_contentsRules.constFind(type);
+    return it != m_contentsRules.constEnd() ? it.value() : noRules;
+}
+
+QString QImagineElementMap::assetName(const QString &family, QImagineAsset::States states) const
+{
+    const auto it = m_families.constFind(family);
+    if (it == m_families.constEnd())
+        return QString();
+    for (const Candidate &candidate : it.value()) {
+        if (!(candidate.states & ~states))
+            return candidate.assetName;
+    }
+    return QString();
+}
+
+QImagineAsset::States QImagineElementMap::states(const QStyleOption *option, const QImagineElementRule *rule)
+{
+    const QStyle::State state = option->state;
+    QImagineAsset::States states = rule ? rule->extraStates : QImagineAsset::States();
+
+    if (!(state & QStyle::State_Enabled))
+        states |= Asset::Disabled;
+    if (state & QStyle::State_HasFocus)
+        states |= Asset::Focused;
+    if (state & QStyle::State_On)
+        states |= Asset::Checked | Asset::Open;
+    if (state & QStyle::State_NoChange)
+        states |= Asset::PartiallyChecked;
+    if ((state & QStyle::State_Selected) && rule)
+        states |= rule->selectedState;
+    if (option->direction == Qt::RightToLeft)
+        states |= Asset::Mirrored;
+
+    // A complex control is pressed or hovered in one of its parts at a time
+    bool active = true;
+    if (rule && (rule->flags & QImagineElementRule::ActivePartOnly)) {
+        if (const auto *complex = qstyleoption_cast<const QStyleOptionComplex *>(option))
+            active = complex->activeSubControls & rule->part;
+    }
+    if (active && (state & QStyle::State_Sunken))
+        states |= Asset::Pressed;
+    if (active && (state & QStyle::State_MouseOver))
+        states |= Asset::Hovered;
+
+    if (const auto *button = qstyleoption_cast<const QStyleOptionButton *>(option)) {
+        if (button->features & QStyleOptionButton::DefaultButton)
+            states |= Asset::Highlighted;
+    } else if (const auto *comboBox = qstyleoption_cast<const QStyleOptionComboBox *>(option)) {
+        if (comboBox->editable)
+            states |= Asset::Editable;
+    } else if (const auto *slider = qstyleoption_cast<const QStyleOptionSlider *>(option)) {
+        states |= slider->orientation == Qt::Horizontal ? Asset::Horizontal : Asset::Vertical;
+    } else if (const auto *spinBox = qstyleoption_cast<const QStyleOptionSpinBox *>(option)) {
+        if (rule && rule->part == QStyle::SC_SpinBoxUp && !(spinBox->stepEnabled & QAbstractSpinBox::StepUpEnabled))
+            states |= Asset::Disabled;
+        if (rule && rule->part == QStyle::SC_SpinBoxDown && !(spinBox->stepEnabled & QAbstractSpinBox::StepDownEnabled))
+            states |= Asset::Disabled;
+    }
+    return states;
+}
+
+bool QImagineElementMap::applies(const QImagineElementRule &rule, const QStyleOption *option)
+{
+    if (rule.flags & QImagineElementRule::FlatButtonOnly) {
+        const auto *button = qstyleoption_cast<const QStyleOptionButton *>(option);
+        return button && (button->features & QStyleOptionButton::Flat);
+    }
+    // Separators are not items; the base style draws and sizes them
+    if (const auto *menuItem = qstyleoption_cast<const QStyleOptionMenuItem *>(option))
+        return menuItem->menuItemType != QStyleOptionMenuItem::Separator;
+    return true;
+}
+
+bool QImagineElementMap::isFrameless(const QStyleOption *option)
+{
+    const auto *frame = qstyleoption_cast<const QStyleOptionFrame *>(option);
+    return frame && frame->lineWidth == 0;
+}
+
+bool QImagineElementMap::isVertical(const QStyleOption *option)
+{
+    if (const auto *slider = qstyleoption_cast<const QStyleOptionSlider *>(option))
+        return slider->orientation == Qt::Vertical;
+    if (const auto *progressBar = qstyleoption_cast<const QStyleOptionProgressBar *>(option))
+        return progressBar->orientation == Qt::Vertical;
+    return false;
+}
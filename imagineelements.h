@@ -0,0 +1,130 @@
+#pragma once
+
+#include <QHash>
+#include <QString>
+#include <QStringList>
+#include <QStyle>
+#include <QVector>
+
+struct QImagineAsset {
+    // The states that asset names carry, like "-checked" in "button-background-checked".
+    // The values are only flags; which state wins when no asset shows all of them is
+    // decided by the priority table in imagineelements.cpp.
+    enum State {
+        NoState = 0x0,
+        Hovered = 0x1,
+        Focused = 0x2,
+        Highlighted = 0x4,
+        PartiallyChecked = 0x8,
+        Checked = 0x10,
+        Open = 0x20,
+        Pressed = 0x40,
+        Disabled = 0x80,
+        Interactive = 0x100,
+        Mirrored = 0x200,
+        Editable = 0x400,
+        Horizontal = 0x800,
+        Vertical = 0x1000
+    };
+    Q_DECLARE_FLAGS(States, State)
+};
+
+Q_DECLARE_OPERATORS_FOR_FLAGS(QImagineAsset::States)
+
+// Maps a style element (or a part of a complex control) to the family of assets that draws it
+struct QImagineElementRule {
+    enum Kind {
+        Primitive,
+        Control,
+        ComplexControl
+    };
+
+    enum Placement {
+        OptionRect,         // option->rect
+        PartRect,           // subControlRect() of the part
+        ValueProgress       // the rect above, cut at the value of the slider or progress bar
+    };
+
+    enum Flag {
+        NoFlags = 0x0,
+        // The base style draws the element as well, on top of the asset (like a label)
+        KeepBasePart = 0x1,
+        // A missing asset leaves the part out, instead of leaving the whole control to the base style
+        OptionalPart = 0x2,
+        // Pressed and hovered only apply while the part is the active sub-control
+        ActivePartOnly = 0x4,
+        // Only applies to push buttons with the Flat feature
+        FlatButtonOnly = 0x8,
+        // Frameless instances are embedded in another control, which draws the background
+        SkipFrameless = 0x10,
+        // Fixed images are drawn at their own size at the top left of the rect, instead of
+        // being stretched to fill it (indicators)
+        NaturalSize = 0x20
+    };
+
+    // How the size of the asset bounds the size of the control (sizeFromContents)
+    enum Sizing {
+        NoSizing,           // the base style's size
+        AssetSize,          // at least as large as the asset
+        AssetThickness      // at least as thick as the asset across the control: as tall when
+                            // horizontal, as wide when vertical
+    };
+
+    // Where the part lies in the control (subControlRect)
+    enum PartAlignment {
+        BaseAlignment,      // the base style's sub-control rect
+        AtStart,            // as wide as the asset, at the leading edge of the control
+        AtEnd,              // as wide as the asset, at the trailing edge of the control
+        Centered,           // the size of the asset, centered on the base style's rect
+        Remainder           // what the AtStart and AtEnd parts of the control leave
+    };
+
+    Kind kind;
+    int element;                                // PrimitiveElement, ControlElement or ComplexControl
+    QStyle::SubControls part;                   // the parts of a complex control, SC_None otherwise
+    const char *family;                         // nullptr leaves the part empty
+    Placement placement;
+    QImagineAsset::States extraStates;          // states that the element always has
+    QImagineAsset::State selectedState;         // what State_Selected means for the element
+    int flags;
+    int contents;                               // the ContentsType that the asset sizes, or -1
+    Sizing sizing;
+    PartAlignment alignment;
+};
+
+class QImagineElementMap
+{
+public:
+    // Indexes which states every family in the table has assets for. Done once at load,
+    // and again when assets are added or removed.
+    void build(const QStringList &assetNames);
+
+    // The rules of an element, in drawing order
+    const QVector<const QImagineElementRule *> &rules(QImagineElementRule::Kind kind, int element) const;
+    // The rules whose assets size a type of contents
+    const QVector<const QImagineElementRule *> &contentsRules(QStyle::ContentsType type) const;
+
+    // Returns the asset of the family that shows the most important of the states, and no state
+    // that isn't among them. Returns an empty string if the family has no such asset.
+    QString assetName(const QString &family, QImagineAsset::States states) const;
+
+    // Orders sets of states by what they show: a set with a state of higher priority ranks
+    // above any set of lower priority states, and a set ranks above its subsets
+    static int rank(QImagineAsset::States states);
+
+    // The states of the element that the option describes
+    static QImagineAsset::States states(const QStyleOption *option, const QImagineElementRule *rule = nullptr);
+    static bool applies(const QImagineElementRule &rule, const QStyleOption *option);
+    static bool isFrameless(const QStyleOption *option);
+    static bool isVertical(const QStyleOption *option);
+
+private:
+    struct Candidate {
+        QImagineAsset::States states;
+        QString assetName;
+    };
+
+    QHash<QString, QVector<Candidate>> m_families;
+    QHash<int, QVector<const QImagineElementRule *>> m_rules[3];
+    QHash<int, QVector<const QImagineElementRule *>> m_contentsRules;
+};
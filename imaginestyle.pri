@@ -0,0 +1,21 @@
+# The style, shared by the demo and the stress gallery
+
+INCLUDEPATH += $$PWD
+
+SOURCES += \
+    $$PWD/imaginediskcache.cpp \
+    $$PWD/imagineelements.cpp \
+    $$PWD/imaginevariants.cpp \
+    $$PWD/ninepatch.cpp \
+    $$PWD/qimaginestyle.cpp \
+    $$PWD/stretchkernel.cpp
+
+HEADERS += \
+    $$PWD/imaginediskcache.h \
+    $$PWD/imagineelements.h \
+    $$PWD/imaginevariants.h \
+    $$PWD/ninepatch.h \
+    $$PWD/qimaginestyle.h \
+    $$PWD/stretchkernel.h
+
+RESOURCES += $$PWD/images
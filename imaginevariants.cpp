@@ -0,0 +1,102 @@
+#include "imaginevariants.h"
+
+// Variants that are a plain color transform or mirror image of another asset in the same family.
+// Each rule gives its shipped files to within 2 in every channel, at every scale. Anything that
+// is not listed here is drawn differently (like the hovered and focused states, and disabled
+// backgrounds), and is always loaded from its file. A family also covers the families that
+// extend its name.
+static const QImagineVariantRule variantRules[] = {
+    { "checkbox-indicator", "disabled", QImagineVariantTransform::Lighten, 0, 0.5 },
+    { "radiobutton-indicator", "disabled", QImagineVariantTransform::Lighten, 0, 0.5 },
+    { "switch-indicator", "disabled", QImagineVariantTransform::Lighten, 0, 0.5 },
+    { "slider-handle", "disabled", QImagineVariantTransform::Tint, 0xffcdd7e5, 0.2 },
+    { "menuitem-arrow", "disabled", QImagineVariantTransform::Tint, 0xffe6e9ed, 1.0 },
+    { "menuitem-arrow", "mirrored", QImagineVariantTransform::Mirror, 0, 0.0 },
+    { "combobox-indicator", "mirrored", QImagineVariantTransform::Mirror, 0, 0.0 },
+    { "spinbox-indicator-up", "mirrored", QImagineVariantTransform::Mirror, 0, 0.0 },
+    { "spinbox-indicator-down", "mirrored", QImagineVariantTransform::Mirror, 0, 0.0 },
+};
+
+const QImagineVariantRule *qImagineVariantRule(const QString &assetName, QString *sourceAssetName)
+{
+    for (const QImagineVariantRule &rule : variantRules) {
+        const QString family = QLatin1String(rule.family) + QLatin1Char('-');
+        if (!assetName.startsWith(family))
+            continue;
+
+        // Find the state as a whole word after the family, like "-hovered" in "...-checked-hovered"
+        const QString state = QLatin1Char('-') + QLatin1String(rule.state);
+        int index = family.length() - 1;
+        while ((index = assetName.indexOf(state, index)) != -1) {
+            const int end = index + state.length();
+            if (end == assetName.length() || assetName.at(end) == QLatin1Char('-')) {
+                *sourceAssetName = assetName.left(index) + assetName.mid(end);
+                return &rule;
+            }
+            index = end;
+        }
+    }
+    return nullptr;
+}
+
+static inline int blendChannel(int channel, int target, qreal amount)
+{
+    return channel + qRound((target - channel) * amount);
+}
+
+static QRgb transformPixel(QRgb pixel, const QImagineVariantRule &rule)
+{
+    // Pixels are premultiplied, so every color channel is at most alpha
+    const int a = qAlpha(pixel);
+    int r = qRed(pixel);
+    int g = qGreen(pixel);
+    int b = qBlue(pixel);
+
+    switch (rule.transform) {
+    case QImagineVariantTransform::Desaturate: {
+        const qreal opacity = 1.0 - rule.amount;
+        const int grey = (r * 11 + g * 16 + b * 5) / 32;
+        return qRgba(qRound(grey * opacity), qRound(grey * opacity), qRound(grey * opacity), qRound(a * opacity));
+    }
+    case QImagineVariantTransform::Lighten:
+        r = blendChannel(r, a, rule.amount);
+        g = blendChannel(g, a, rule.amount);
+        b = blendChannel(b, a, rule.amount);
+        break;
+    case QImagineVariantTransform::Tint:
+        r = blendChannel(r, qRed(rule.color) * a / 255, rule.amount);
+        g = blendChannel(g, qGreen(rule.color) * a / 255, rule.amount);
+        b = blendChannel(b, qBlue(rule.color) * a / 255, rule.amount);
+        break;
+    case QImagineVariantTransform::Mirror:
+        break;
+    }
+    return qRgba(r, g, b, a);
+}
+
+QImage qImagineDeriveVariant(const QImage &source, const QImagineVariantRule &rule, bool ninePatch)
+{
+    QImage image = source.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+
+    if (rule.transform == QImagineVariantTransform::Mirror) {
+        image = image.mirrored(true, false);
+        if (ninePatch) {
+            // The top and bottom markers mirror along with the content, but the left (stretch)
+            // and right (content) marker columns must stay on their own side
+            const int right = image.width() - 1;
+            for (int y = 0; y < image.height(); ++y) {
+                QRgb *line = reinterpret_cast<QRgb *>(image.scanLine(y));
+                qSwap(line[0], line[right]);
+            }
+        }
+        return image;
+    }
+
+    const QRect area = ninePatch ? image.rect().adjusted(1, 1, -1, -1) : image.rect();
+    for (int y = area.top(); y <= area.bottom(); ++y) {
+        QRgb *line = reinterpret_cast<QRgb *>(image.scanLine(y));
+        for (int x = area.left(); x <= area.right(); ++x)
+            line[x] = transformPixel(line[x], rule);
+    }
+    return image;
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <QImage>
+#include <QString>
+
+enum class QImagineVariantTransform {
+    Desaturate,     // grey, and faded by (1 - amount)
+    Lighten,        // blended towards white by amount
+    Tint,           // blended towards color by amount
+    Mirror          // flipped horizontally
+};
+
+struct QImagineVariantRule {
+    const char *family;
+    const char *state;
+    QImagineVariantTransform transform;
+    QRgb color;
+    qreal amount;
+};
+
+// Looks up the rule that can derive an asset (like "button-background-checked-hovered") from
+// another one, and returns it together with the name of that other asset ("button-background-checked").
+// Returns nullptr if the asset has to come from a file.
+const QImagineVariantRule *qImagineVariantRule(const QString &assetName, QString *sourceAssetName);
+
+// Applies the rule to a premultiplied ARGB32 image. The border of nine-patch images is left
+// alone, apart from being mirrored together with the content.
+QImage qImagineDeriveVariant(const QImage &source, const QImagineVariantRule &rule, bool ninePatch);
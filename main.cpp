@@ -7,7 +7,12 @@ int main(int argc, char *argv[])
 {
     QApplication app(argc, argv);
 
-    app.setStyle(new QImagineStyle(QStringLiteral(":/images")));
+    // Run with the path to a directory of assets to see edits to them without restarting
+    const QStringList arguments = app.arguments();
+    if (arguments.size() > 1)
+        app.setStyle(new QImagineStyle(arguments.at(1), QImagineStyle::WatchImagePath));
+    else
+        app.setStyle(new QImagineStyle(QStringLiteral(":/images")));
 
     MainWindow w;
     w.show();
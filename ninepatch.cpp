@@ -1,15 +1,102 @@
 #include "ninepatch.h"
 #include <QRect>
 #include <QDebug>
+#include <QPaintEngine>
+#include <QVarLengthArray>
+#include <algorithm>
+#include <cstring>
+
+// Upper bound, in pixels, for the renders kept per nine-patch image
+static const int maxCachedPixels = 4 * 1024 * 1024;
+static const int maxCachedLayouts = 256;
+// Copying the interior takes up to four more drawImage() calls and two composition mode
+// changes. Where that pays off depends on the machine; the stress gallery's
+// --opaque-benchmark prints the crossover.
+static const int defaultOpaqueBlitArea = 64 * 64;
+
+static quint64 sizeKey(const QSize &size)
+{
+    return (quint64(size.width()) << 32) | quint32(size.height());
+}
+
+static bool isOpaque(const QImage &image, const QRect &rect)
+{
+    // Expects a premultiplied ARGB32 image
+    for (int y = rect.top(); y <= rect.bottom(); ++y) {
+        const QRgb *line = reinterpret_cast<const QRgb *>(image.constScanLine(y));
+        for (int x = rect.left(); x <= rect.right(); ++x) {
+            if (qAlpha(line[x]) != 255)
+                return false;
+        }
+    }
+    return true;
+}
+
+static bool canBlitOpaque(const QPainter *painter, const QImage &image)
+{
+    // Copying instead of blending only gives the same result when nothing else is applied
+    // to the source, and only pays off on the raster engine when image pixels map 1:1 onto
+    // device pixels (otherwise the parts are transformed separately, and can leave seams).
+    if (painter->paintEngine()->type() != QPaintEngine::Raster)
+        return false;
+    if (painter->compositionMode() != QPainter::CompositionMode_SourceOver || painter->opacity() < 1.0)
+        return false;
+    const QTransform transform = painter->deviceTransform();
+    if (transform.type() == QTransform::TxTranslate || transform.type() == QTransform::TxNone)
+        return qFuzzyCompare(image.devicePixelRatio(), 1.0);
+    return transform.type() == QTransform::TxScale
+            && qFuzzyCompare(transform.m11(), image.devicePixelRatio())
+            && qFuzzyCompare(transform.m22(), image.devicePixelRatio());
+}
+
+static void borderParts(const QSize &size, const QRect &opaque, QRect parts[4])
+{
+    // The bands around the opaque interior: above, below, left and right of it
+    parts[0] = QRect(0, 0, size.width(), opaque.top());
+    parts[1] = QRect(0, opaque.bottom() + 1, size.width(), size.height() - opaque.bottom() - 1);
+    parts[2] = QRect(0, opaque.top(), opaque.left(), opaque.height());
+    parts[3] = QRect(opaque.right() + 1, opaque.top(), size.width() - opaque.right() - 1, opaque.height());
+}
+
+typedef QVarLengthArray<QPainter::PixmapFragment, 64> PixmapFragments;
+
+static bool drawsFragments(const QPainter *painter)
+{
+    // The raster engine has no fragment drawing of its own. The fallback draws the fragments
+    // one at a time, with a transform each and without the opaque hint, which is slower than
+    // drawing the rects one by one.
+    return painter->paintEngine()->type() != QPaintEngine::Raster;
+}
+
+static void appendFragment(PixmapFragments &fragments, const QPointF &targetPos, const QRect &source, qreal scale)
+{
+    // Fragments are placed by their center
+    if (!source.isEmpty())
+        fragments.append(QPainter::PixmapFragment::create(targetPos + QRectF(source).center() * scale, source, scale, scale));
+}
+
+void QImagineStyleImage::drawBatch(QPainter *painter, const QVector<QRect> &targetRects) const
+{
+    for (const QRect &targetRect : targetRects)
+        draw(painter, targetRect);
+}
 
 QStyleNinePatchImage::QStyleNinePatchImage(const QImage &image)
     : m_image(image)
+    , m_cachedImages(maxCachedPixels)
+    , m_pixmaps(maxCachedPixels)
+    , m_layouts(maxCachedLayouts)
+    , m_opaqueBlitArea(defaultOpaqueBlitArea)
 {
     updateContentArea();
     updateResizeArea();
 
     if (!m_resizeDistancesX.size() || !m_resizeDistancesY.size())
         throw new ExceptionNot9Patch;
+
+    // The stretch kernel reads and writes premultiplied pixels directly
+    m_image = m_image.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+    updateOpaqueArea();
 }
 
 QStyleNinePatchImage::~QStyleNinePatchImage()
@@ -18,11 +105,96 @@ QStyleNinePatchImage::~QStyleNinePatchImage()
 
 void QStyleNinePatchImage::draw(QPainter *painter, const QRect &targetRect) const
 {
-    const qreal dpr = m_image.devicePixelRatio();
-    const QPoint pos = targetRect.topLeft();
-    const QSize imageSize = targetRect.size() * dpr;
-    const_cast<QStyleNinePatchImage *>(this)->setImageSize(imageSize.width(), imageSize.height());
-    painter->drawImage(pos.x(), pos.y(), m_cachedImage);
+    // Like a progress bar at its minimum, rather than the smallest size the image can have
+    if (targetRect.isEmpty())
+        return;
+
+    const Render render = cachedRender(pixelSize(targetRect.size()));
+    const QImage &image = render.image;
+    const QRect &opaque = render.opaqueRect;
+
+    const bool blitOpaque = m_opaqueBlitArea >= 0 && !opaque.isEmpty()
+            && opaque.width() * opaque.height() >= m_opaqueBlitArea;
+    if (!blitOpaque || !canBlitOpaque(painter, image)) {
+        painter->drawImage(targetRect.topLeft(), image);
+        return;
+    }
+
+    // Copy the opaque interior, and only blend the borders around it
+    const qreal dpr = image.devicePixelRatio();
+    const QPointF pos = targetRect.topLeft();
+    const auto drawPart = [&](const QRect &source) {
+        if (!source.isEmpty())
+            painter->drawImage(QRectF(pos + QPointF(source.topLeft()) / dpr, QSizeF(source.size()) / dpr), image, source);
+    };
+
+    painter->setCompositionMode(QPainter::CompositionMode_Source);
+    drawPart(opaque);
+    painter->setCompositionMode(QPainter::CompositionMode_SourceOver);
+    QRect parts[4];
+    borderParts(image.size(), opaque, parts);
+    for (const QRect &part : parts)
+        drawPart(part);
+}
+
+void QStyleNinePatchImage::drawBatch(QPainter *painter, const QVector<QRect> &targetRects) const
+{
+    if (targetRects.size() < 2 || !drawsFragments(painter)) {
+        QImagineStyleImage::drawBatch(painter, targetRects);
+        return;
+    }
+
+    // Targets of the same size share a render, which is drawn into all of them with a single call.
+    // Only engines other than raster get here, and they blend the opaque interiors as well.
+    QVector<bool> drawn(targetRects.size(), false);
+    PixmapFragments fragments;
+    for (int i = 0; i < targetRects.size(); ++i) {
+        if (drawn[i] || targetRects[i].isEmpty())
+            continue;
+
+        const QSize size = targetRects[i].size();
+        const QSize renderSize = pixelSize(size);
+        const Render render = cachedRender(renderSize);
+        const QImage &image = render.image;
+        const qreal scale = 1.0 / image.devicePixelRatio();
+
+        fragments.clear();
+        for (int j = i; j < targetRects.size(); ++j) {
+            if (drawn[j] || targetRects[j].size() != size)
+                continue;
+            drawn[j] = true;
+            appendFragment(fragments, targetRects[j].topLeft(), image.rect(), scale);
+        }
+
+        painter->drawPixmapFragments(fragments.constData(), fragments.size(), renderPixmap(renderSize, render));
+    }
+}
+
+void QStyleNinePatchImage::prepare(const QSize &targetSize) const
+{
+    const QSize size = pixelSize(targetSize);
+    {
+        // Preparing is not a use of the render, so neither its hits nor the statistics count it;
+        // otherwise the renders that were pre-warmed would look like the most used ones
+        QMutexLocker locker(&m_cacheMutex);
+        if (m_cachedImages.contains(sizeKey(size)))
+            return;
+    }
+    addRender(size);
+}
+
+void QStyleNinePatchImage::setStretchQuality(QImagineStretchQuality quality)
+{
+    QMutexLocker locker(&m_cacheMutex);
+    if (quality == m_stretchQuality)
+        return;
+    m_stretchQuality = quality;
+    m_cachedImages.clear();
+}
+
+void QStyleNinePatchImage::setOpaqueBlitArea(int pixels)
+{
+    m_opaqueBlitArea = pixels;
 }
 
 QSize QStyleNinePatchImage::size() const
@@ -32,8 +204,14 @@ QSize QStyleNinePatchImage::size() const
     return (m_image.size() - ninePMargins) / m_image.devicePixelRatio();
 }
 
-void QStyleNinePatchImage::setImageSize(int width, int height)
+QImage QStyleNinePatchImage::image() const
 {
+    return m_image;
+}
+
+QSize QStyleNinePatchImage::pixelSize(const QSize &targetSize) const
+{
+    const QSize size = targetSize * m_image.devicePixelRatio();
     int resizeWidth = 0;
     int resizeHeight = 0;
 
@@ -42,34 +220,157 @@ void QStyleNinePatchImage::setImageSize(int width, int height)
     for (int i = 0; i < m_resizeDistancesY.size(); i++)
           resizeHeight += m_resizeDistancesY[i].second;
 
-    width = qMax(width, (m_image.width() - 2 - resizeWidth));
-    height = qMax(height, (m_image.height() - 2 - resizeHeight));
+    const int width = qMax(size.width(), (m_image.width() - 2 - resizeWidth));
+    const int height = qMax(size.height(), (m_image.height() - 2 - resizeHeight));
+    return QSize(width, height);
+}
 
-    if (width != m_cachedImage.width() || height != m_cachedImage.height())
-        updateCachedImage(width, height);
+QStyleNinePatchImage::Render QStyleNinePatchImage::cachedRender(const QSize &pixelSize) const
+{
+    Render render;
+    if (findRender(sizeKey(pixelSize), &render))
+        return render;
+    return addRender(pixelSize);
 }
 
-void QStyleNinePatchImage::drawScaledPart(QRect oldRect, QRect newRect, QPainter& painter)
+bool QStyleNinePatchImage::findRender(quint64 key, Render *render) const
 {
-    if (newRect.isEmpty())
-        return;
+    QMutexLocker locker(&m_cacheMutex);
+    if (Render *cached = m_cachedImages.object(key)) {
+        ++cached->hits;
+        ++m_cacheHits;
+        *render = *cached;
+        return true;
+    }
+    ++m_cacheMisses;
+    return false;
+}
+
+QStyleNinePatchImage::Render QStyleNinePatchImage::addRender(const QSize &pixelSize) const
+{
+    // Render without holding the lock, so that painting never waits for the pre-warm
+    // worker. If both end up rendering the same size, the last one simply wins.
+    const Layout layout = cachedLayout(pixelSize);
+    Render render;
+    render.image = renderImage(layout, pixelSize);
+    render.opaqueRect = layout.opaqueRect;
+    QMutexLocker locker(&m_cacheMutex);
+    m_cachedImages.insert(sizeKey(pixelSize), new Render(render), render.image.width() * render.image.height());
+    return render;
+}
+
+QPixmap QStyleNinePatchImage::renderPixmap(const QSize &pixelSize, const Render &render) const
+{
+    // A pixmap is only reused while its render is the one in the cache; the render can
+    // have been evicted and made again, or replaced by the pre-warm worker
+    const quint64 key = sizeKey(pixelSize);
+    const qint64 imageKey = render.image.cacheKey();
+    if (const RenderPixmap *cached = m_pixmaps.object(key)) {
+        if (cached->imageKey == imageKey)
+            return cached->pixmap;
+    }
+
+    // Without opaque detection the pixmap shares the pixels of the image, instead of scanning
+    // them and converting an opaque render to RGB32
+    const QPixmap pixmap = QPixmap::fromImage(render.image, Qt::NoOpaqueDetection);
+    m_pixmaps.insert(key, new RenderPixmap{ imageKey, pixmap }, render.image.width() * render.image.height());
+    return pixmap;
+}
 
-    QImage img = m_image.copy(oldRect);
-    img = img.scaled(newRect.width(), newRect.height());
+QVector<QImage> QStyleNinePatchImage::mostUsedRenders(int count) const
+{
+    QMutexLocker locker(&m_cacheMutex);
+    QVector<const Render *> renders;
+    const auto keys = m_cachedImages.keys();
+    for (const quint64 key : keys)
+        renders.append(m_cachedImages.object(key));
+    std::sort(renders.begin(), renders.end(), [](const Render *a, const Render *b) {
+        return a->hits > b->hits;
+    });
+
+    QVector<QImage> images;
+    for (int i = 0; i < qMin(count, renders.size()); ++i)
+        images.append(renders[i]->image);
+    return images;
+}
+
+void QStyleNinePatchImage::insertRender(const QImage &render)
+{
+    const quint64 key = sizeKey(render.size());
+    Render *entry = new Render;
+    entry->image = render;
+    entry->opaqueRect = cachedLayout(render.size()).opaqueRect;
+    QMutexLocker locker(&m_cacheMutex);
+    m_cachedImages.insert(key, entry, render.width() * render.height());
+}
+
+QImagineRenderCacheStats QStyleNinePatchImage::renderCacheStats() const
+{
+    QMutexLocker locker(&m_cacheMutex);
+    QImagineRenderCacheStats stats;
+    // The cost of a render is its pixel count, and renders are 32 bits per pixel
+    stats.renderCount = m_cachedImages.count();
+    stats.renderBytes = qint64(m_cachedImages.totalCost()) * 4;
+    stats.hits = m_cacheHits;
+    stats.misses = m_cacheMisses;
+    return stats;
+}
+
+QStyleNinePatchImage::Layout QStyleNinePatchImage::cachedLayout(const QSize &pixelSize) const
+{
+    const quint64 key = sizeKey(pixelSize);
+    {
+        QMutexLocker locker(&m_cacheMutex);
+        if (const Layout *layout = m_layouts.object(key))
+            return *layout;
+    }
 
-    // Since we're working with actual pixels (and not points)
-    // we need to undo the scaling set on the painter
-    const qreal dpr = painter.device()->devicePixelRatio();
-    painter.drawImage(newRect.x() / dpr, newRect.y() / dpr, img);
+    const Layout layout = computeLayout(pixelSize);
+    QMutexLocker locker(&m_cacheMutex);
+    m_layouts.insert(key, new Layout(layout));
+    return layout;
 }
 
-void QStyleNinePatchImage::drawConstPart(QRect oldRect, QRect newRect, QPainter& painter) {
-    QImage img = m_image.copy(oldRect);
-    const qreal dpr = painter.device()->devicePixelRatio();
+static void copyPixels(const QImage &source, const QRect &sourceRect, QImage &target, const QPoint &targetPos)
+{
+    // Clip against both images, the same way QPainter would have done
+    const QRect targetRect = QRect(targetPos, sourceRect.size()) & target.rect();
+    const QRect unclippedSource(sourceRect.topLeft() + (targetRect.topLeft() - targetPos), targetRect.size());
+    const QRect clippedSource = unclippedSource & source.rect();
+    if (clippedSource.isEmpty())
+        return;
 
-    // Since we're working with actual pixels (and not points)
-    // we need to undo the scaling set on the painter
-    painter.drawImage(newRect.x() / dpr, newRect.y() / dpr, img);
+    const QPoint clippedTargetPos = targetRect.topLeft() + (clippedSource.topLeft() - unclippedSource.topLeft());
+    for (int y = 0; y < clippedSource.height(); ++y) {
+        const uchar *sourceLine = source.constScanLine(clippedSource.y() + y) + clippedSource.x() * 4;
+        uchar *targetLine = target.scanLine(clippedTargetPos.y() + y) + clippedTargetPos.x() * 4;
+        memcpy(targetLine, sourceLine, size_t(clippedSource.width()) * 4);
+    }
+}
+
+void QStyleNinePatchImage::drawScaledPart(QRect oldRect, QRect newRect, QImage& image) const
+{
+    oldRect &= m_image.rect();
+    if (newRect.isEmpty() || oldRect.isEmpty())
+        return;
+
+    // We're working with actual pixels (and not points), so the rects map directly onto the bits
+    const uchar *src = m_image.constScanLine(oldRect.y()) + oldRect.x() * 4;
+    if (image.rect().contains(newRect)) {
+        uchar *dst = image.scanLine(newRect.y()) + newRect.x() * 4;
+        qImagineStretch(src, m_image.bytesPerLine(), oldRect.width(), oldRect.height(),
+                        dst, image.bytesPerLine(), newRect.width(), newRect.height(), m_stretchQuality);
+        return;
+    }
+
+    QImage part(newRect.size(), QImage::Format_ARGB32_Premultiplied);
+    qImagineStretch(src, m_image.bytesPerLine(), oldRect.width(), oldRect.height(),
+                    part.bits(), part.bytesPerLine(), part.width(), part.height(), m_stretchQuality);
+    copyPixels(part, part.rect(), image, newRect.topLeft());
+}
+
+void QStyleNinePatchImage::drawConstPart(QRect oldRect, QRect newRect, QImage& image) const {
+    copyPixels(m_image, oldRect, image, newRect.topLeft());
 }
 
 inline bool pixelsBlack(QRgb color)
@@ -163,171 +464,183 @@ void QStyleNinePatchImage::updateResizeArea()
     }
 }
 
-void QStyleNinePatchImage::getFactor(int width, int height, double& factorX, double& factorY)
+void QStyleNinePatchImage::updateOpaqueArea()
 {
-    int topResize = width - (m_image.width() - 2);
-    int leftResize = height - (m_image.height() - 2);
-    for (int i = 0; i < m_resizeDistancesX.size(); i++) {
-        topResize += m_resizeDistancesX[i].second;
-        factorX += m_resizeDistancesX[i].second;
+    // Find the largest rect of opaque pixels that contains all the stretched parts. Drawing can
+    // then copy that area instead of blending it, which is the bulk of a typical background.
+    const auto &lastX = m_resizeDistancesX.last();
+    const auto &lastY = m_resizeDistancesY.last();
+    const int left = m_resizeDistancesX.first().first + 1;
+    const int top = m_resizeDistancesY.first().first + 1;
+    QRect area(QPoint(left, top), QPoint(lastX.first + lastX.second, lastY.first + lastY.second));
+    if (!isOpaque(m_image, area))
+        return;
+
+    // Grow over opaque fixed parts, but stay clear of the nine-patch markers
+    const QRect inside = m_image.rect().adjusted(1, 1, -1, -1);
+    while (area.left() > inside.left() && isOpaque(m_image, QRect(area.left() - 1, area.top(), 1, area.height())))
+        area.setLeft(area.left() - 1);
+    while (area.right() < inside.right() && isOpaque(m_image, QRect(area.right() + 1, area.top(), 1, area.height())))
+        area.setRight(area.right() + 1);
+    while (area.top() > inside.top() && isOpaque(m_image, QRect(area.left(), area.top() - 1, area.width(), 1)))
+        area.setTop(area.top() - 1);
+    while (area.bottom() < inside.bottom() && isOpaque(m_image, QRect(area.left(), area.bottom() + 1, area.width(), 1)))
+        area.setBottom(area.bottom() + 1);
+
+    m_opaqueArea = area;
+}
+
+namespace {
+
+// A run of columns or rows of the source image, in content coordinates, and where it goes in a render
+struct Segment {
+    int sourceStart;
+    int sourceLength;
+    int targetStart;
+    int targetLength;
+    bool stretched;
+};
+
+} // namespace
+
+static QVector<Segment> layoutSegments(const QVector<std::pair<int, int>> &stretches, int sourceLength, int targetLength)
+{
+    // Fixed runs keep their length, and the stretched runs share the rest in proportion to their
+    // source lengths. Each stretched run ends where the rounded down share of all the runs up to
+    // and including it ends, so the lengths always add up exactly, using integers only.
+    qint64 stretchLength = 0;
+    for (const auto &stretch : stretches)
+        stretchLength += stretch.second;
+    const qint64 available = targetLength - (sourceLength - stretchLength);
+
+    QVector<Segment> segments;
+    int sourcePos = 0;
+    int targetPos = 0;
+    const auto append = [&](int length, int newLength, bool stretched) {
+        segments.append({ sourcePos, length, targetPos, newLength, stretched });
+        sourcePos += length;
+        targetPos += newLength;
+    };
+
+    qint64 stretchedSource = 0;
+    qint64 stretchedTarget = 0;
+    for (const auto &stretch : stretches) {
+        append(stretch.first - sourcePos, stretch.first - sourcePos, false);
+        stretchedSource += stretch.second;
+        const qint64 end = available * stretchedSource / stretchLength;
+        append(stretch.second, int(end - stretchedTarget), true);
+        stretchedTarget = end;
     }
-    for (int i = 0; i < m_resizeDistancesY.size(); i++) {
-        leftResize += m_resizeDistancesY[i].second;
-        factorY += m_resizeDistancesY[i].second;
+    append(sourceLength - sourcePos, sourceLength - sourcePos, false);
+    return segments;
+}
+
+static int mapEdge(const QVector<Segment> &segments, int sourcePos)
+{
+    // Edges inside a stretched run have no exact place, but they are never asked for
+    for (const Segment &segment : segments) {
+        const int sourceEnd = segment.sourceStart + segment.sourceLength;
+        if (sourcePos < segment.sourceStart || sourcePos > sourceEnd)
+            continue;
+        if (!segment.stretched)
+            return segment.targetStart + sourcePos - segment.sourceStart;
+        if (sourcePos == segment.sourceStart)
+            return segment.targetStart;
+        if (sourcePos == sourceEnd)
+            return segment.targetStart + segment.targetLength;
     }
-    factorX = (double)topResize / factorX;
-    factorY = (double)leftResize / factorY;
-}
-
-void QStyleNinePatchImage::updateCachedImage(int width, int height)
-{
-    // TODO: Don't cache the image, just redraw it directly using the painter. Different widgets
-    // of the same type will usually have different size (when it's a 9p image). So caching should
-    // be unnecessary.
-
-    m_cachedImage = QImage(width, height, QImage::Format_ARGB32_Premultiplied);
-    m_cachedImage.setDevicePixelRatio(m_image.devicePixelRatio());
-    m_cachedImage.fill(0);
-
-    QPainter painter(&m_cachedImage);
-
-    double factorX = 0.0;
-    double factorY = 0.0;
-    getFactor(width, height, factorX, factorY);
-    double lostX = 0.0;
-    double lostY = 0.0;
-    int x1 = 0; //for image parts X
-    int y1 = 0; //for image parts Y
-    int widthResize; //width for image parts
-    int heightResize; //height for image parts
-    int resizeX = 0;
-    int resizeY = 0;
-    int offsetX = 0;
-    int offsetY = 0;
-
-    for (int i = 0; i < m_resizeDistancesX.size(); i++) {
-        y1 = 0;
-        offsetY = 0;
-        lostY = 0.0;
-        for (int  j = 0; j < m_resizeDistancesY.size(); j++) {
-            widthResize = m_resizeDistancesX[i].first - x1;
-            heightResize = m_resizeDistancesY[j].first - y1;
-
-            drawConstPart(QRect(x1 + 1, y1 + 1, widthResize, heightResize),
-                          QRect(x1 + offsetX, y1 + offsetY, widthResize, heightResize), painter);
-
-            int y2 = m_resizeDistancesY[j].first;
-
-            heightResize = m_resizeDistancesY[j].second;
-            resizeY = round((double)heightResize * factorY);
-            lostY += resizeY - ((double)heightResize * factorY);
-            if (fabs(lostY) >= 1.0) {
-                if (lostY < 0) {
-                    resizeY += 1;
-                    lostY += 1.0;
-                } else {
-                    resizeY -= 1;
-                    lostY -= 1.0;
-                }
-            }
-
-            drawScaledPart(QRect(x1 + 1, y2 + 1, widthResize, heightResize),
-                           QRect(x1 + offsetX, y2 + offsetY, widthResize, resizeY), painter);
-
-            int  x2 = m_resizeDistancesX[i].first;
-            widthResize = m_resizeDistancesX[i].second;
-            heightResize = m_resizeDistancesY[j].first - y1;
-            resizeX = round((double)widthResize * factorX);
-            lostX += resizeX - ((double)widthResize * factorX);
-            if (fabs(lostX) >= 1.0) {
-                if (lostX < 0) {
-                    resizeX += 1;
-                    lostX += 1.0;
-                } else {
-                    resizeX -= 1;
-                    lostX -= 1.0;
-                }
-            }
-            drawScaledPart(QRect(x2 + 1, y1 + 1, widthResize, heightResize),
-                           QRect(x2 + offsetX, y1 + offsetY, resizeX, heightResize), painter);
-
-            heightResize = m_resizeDistancesY[j].second;
-            drawScaledPart(QRect(x2 + 1, y2 + 1, widthResize, heightResize),
-                           QRect(x2 + offsetX, y2 + offsetY, resizeX, resizeY), painter);
-
-            y1 = m_resizeDistancesY[j].first + m_resizeDistancesY[j].second;
-            offsetY += resizeY - m_resizeDistancesY[j].second;
+    return segments.last().targetStart + segments.last().targetLength;
+}
+
+QStyleNinePatchImage::Layout QStyleNinePatchImage::computeLayout(const QSize &pixelSize) const
+{
+    const QVector<Segment> columns = layoutSegments(m_resizeDistancesX, m_image.width() - 2, pixelSize.width());
+    const QVector<Segment> rows = layoutSegments(m_resizeDistancesY, m_image.height() - 2, pixelSize.height());
+
+    Layout layout;
+    for (const Segment &row : rows) {
+        for (const Segment &column : columns) {
+            if (!row.sourceLength || !column.sourceLength)
+                continue;
+            // The source is offset by the marker lines
+            const QRect source(column.sourceStart + 1, row.sourceStart + 1, column.sourceLength, row.sourceLength);
+            const QRect target(column.targetStart, row.targetStart, column.targetLength, row.targetLength);
+            layout.slices.append({ source, target, column.stretched || row.stretched });
         }
-        x1 = m_resizeDistancesX[i].first + m_resizeDistancesX[i].second;
-        offsetX += resizeX - m_resizeDistancesX[i].second;
     }
-    x1 = m_resizeDistancesX[m_resizeDistancesX.size() - 1].first + m_resizeDistancesX[m_resizeDistancesX.size() - 1].second;
-    widthResize = m_image.width() - x1 - 2;
-    y1 = 0;
-    lostX = 0.0;
-    lostY = 0.0;
-    offsetY = 0;
-    for (int i = 0; i < m_resizeDistancesY.size(); i++) {
-        drawConstPart(QRect(x1 + 1, y1 + 1, widthResize, m_resizeDistancesY[i].first - y1),
-                      QRect(x1 + offsetX, y1 + offsetY, widthResize, m_resizeDistancesY[i].first - y1), painter);
-        y1 = m_resizeDistancesY[i].first;
-        resizeY = round((double)m_resizeDistancesY[i].second * factorY);
-        lostY += resizeY - ((double)m_resizeDistancesY[i].second * factorY);
-        if (fabs(lostY) >= 1.0) {
-            if (lostY < 0) {
-                resizeY += 1;
-                lostY += 1.0;
-            } else {
-                resizeY -= 1;
-                lostY -= 1.0;
-            }
-        }
-        drawScaledPart(QRect(x1 + 1, y1 + 1, widthResize, m_resizeDistancesY[i].second),
-                       QRect(x1 + offsetX, y1 + offsetY, widthResize, resizeY), painter);
-        y1 = m_resizeDistancesY[i].first + m_resizeDistancesY[i].second;
-        offsetY += resizeY - m_resizeDistancesY[i].second;
+
+    // The opaque area contains all the stretched runs, so its edges land on exact pixels
+    if (!m_opaqueArea.isEmpty()) {
+        const QPoint topLeft(mapEdge(columns, m_opaqueArea.left() - 1), mapEdge(rows, m_opaqueArea.top() - 1));
+        const QPoint bottomRight(mapEdge(columns, m_opaqueArea.right()), mapEdge(rows, m_opaqueArea.bottom()));
+        layout.opaqueRect = QRect(topLeft, bottomRight - QPoint(1, 1));
     }
-    y1 = m_resizeDistancesY[m_resizeDistancesY.size() - 1].first + m_resizeDistancesY[m_resizeDistancesY.size() - 1].second;
-    heightResize = m_image.height() - y1 - 2;
-    x1 = 0;
-    offsetX = 0;
-    for (int i = 0; i < m_resizeDistancesX.size(); i++) {
-        drawConstPart(QRect(x1 + 1, y1 + 1, m_resizeDistancesX[i].first - x1, heightResize),
-                      QRect(x1 + offsetX, y1 + offsetY, m_resizeDistancesX[i].first - x1, heightResize), painter);
-        x1 = m_resizeDistancesX[i].first;
-        resizeX = round((double)m_resizeDistancesX[i].second * factorX);
-        lostX += resizeX - ((double)m_resizeDistancesX[i].second * factorX);
-        if (fabs(lostX) >= 1.0) {
-            if (lostX < 0) {
-                resizeX += 1;
-                lostX += 1.0;
-            } else {
-                resizeX -= 1;
-                lostX += 1.0;
-            }
-        }
-        drawScaledPart(QRect(x1 + 1, y1 + 1, m_resizeDistancesX[i].second, heightResize),
-                       QRect(x1 + offsetX, y1 + offsetY, resizeX, heightResize), painter);
-        x1 = m_resizeDistancesX[i].first + m_resizeDistancesX[i].second;
-        offsetX += resizeX - m_resizeDistancesX[i].second;
+    return layout;
+}
+
+QImage QStyleNinePatchImage::renderImage(const Layout &layout, const QSize &pixelSize) const
+{
+    // The slices cover the whole render, so there is no need to clear it first
+    QImage image(pixelSize, QImage::Format_ARGB32_Premultiplied);
+    image.setDevicePixelRatio(m_image.devicePixelRatio());
+
+    for (const Slice &slice : layout.slices) {
+        if (slice.stretched)
+            drawScaledPart(slice.source, slice.target, image);
+        else
+            drawConstPart(slice.source, slice.target, image);
     }
-    x1 = m_resizeDistancesX[m_resizeDistancesX.size() - 1].first + m_resizeDistancesX[m_resizeDistancesX.size() - 1].second;
-    widthResize = m_image.width() - x1 - 2;
-    y1 = m_resizeDistancesY[m_resizeDistancesY.size() - 1].first + m_resizeDistancesY[m_resizeDistancesY.size() - 1].second;
-    heightResize = m_image.height() - y1 - 2;
-    drawConstPart(QRect(x1 + 1, y1 + 1, widthResize, heightResize),
-                  QRect(x1 + offsetX, y1 + offsetY, widthResize, heightResize), painter);
+    return image;
 }
 
 QImagineStyleFixedImage::QImagineStyleFixedImage(const QPixmap &pixmap)
     : QImagineStyleImage()
     , m_pixmap(pixmap)
 {
+    // PNGs with an alpha channel are decoded as such even when every pixel is opaque.
+    // Dropping the channel lets the paint engine copy the pixmap instead of blending it.
+    if (m_pixmap.hasAlphaChannel()) {
+        const QImage image = m_pixmap.toImage().convertToFormat(QImage::Format_ARGB32_Premultiplied);
+        if (isOpaque(image, image.rect())) {
+            m_pixmap = QPixmap::fromImage(image.convertToFormat(QImage::Format_RGB32));
+            m_pixmap.setDevicePixelRatio(pixmap.devicePixelRatio());
+        }
+    }
 }
 
 void QImagineStyleFixedImage::draw(QPainter *painter, const QRect &targetRect) const
 {
-    painter->drawPixmap(targetRect.topLeft(), m_pixmap);
+    // Strips like toolbar-background are stretched along the rect. Most draws are at the
+    // image's own size though, which the paint engine can copy without scaling.
+    if (targetRect.isEmpty())
+        return;
+    if (targetRect.size() == size())
+        painter->drawPixmap(targetRect.topLeft(), m_pixmap);
+    else
+        painter->drawPixmap(targetRect, m_pixmap);
+}
+
+void QImagineStyleFixedImage::drawBatch(QPainter *painter, const QVector<QRect> &targetRects) const
+{
+    if (targetRects.size() < 2 || !drawsFragments(painter)) {
+        QImagineStyleImage::drawBatch(painter, targetRects);
+        return;
+    }
+
+    // Stretched to fill each rect, like draw() does
+    PixmapFragments fragments;
+    for (const QRect &targetRect : targetRects) {
+        if (targetRect.isEmpty())
+            continue;
+        const qreal scaleX = qreal(targetRect.width()) / m_pixmap.width();
+        const qreal scaleY = qreal(targetRect.height()) / m_pixmap.height();
+        fragments.append(QPainter::PixmapFragment::create(QRectF(targetRect).center(), m_pixmap.rect(), scaleX, scaleY));
+    }
+
+    QPainter::PixmapFragmentHints hints;
+    if (!m_pixmap.hasAlphaChannel())
+        hints |= QPainter::OpaqueHint;
+    painter->drawPixmapFragments(fragments.constData(), fragments.size(), m_pixmap, hints);
 }
 
 QSize QImagineStyleFixedImage::size() const
@@ -339,3 +652,54 @@ QSize QImagineStyleFixedImage::size() const
     // this function, so the error must be somewhere else.
     return m_pixmap.size() / m_pixmap.devicePixelRatioF();
 }
+
+QImage QImagineStyleFixedImage::image() const
+{
+    return m_pixmap.toImage();
+}
+
+static void scaleMarkers(const QImage &source, QImage &target, bool horizontal, int line, int targetLine, qreal factor)
+{
+    // Markers are runs of black pixels between the two corners. Map the start and end of
+    // each run separately, so that the runs keep covering the same part of the content.
+    const int length = (horizontal ? source.width() : source.height()) - 2;
+    const int targetLength = (horizontal ? target.width() : target.height()) - 2;
+    int start = -1;
+    for (int i = 0; i <= length; ++i) {
+        const bool black = i < length
+                && pixelsBlack(horizontal ? source.pixel(i + 1, line) : source.pixel(line, i + 1));
+        if (black && start == -1)
+            start = i;
+        if (black || start == -1)
+            continue;
+
+        const int targetStart = qMin(qRound(start * factor), targetLength - 1);
+        const int targetEnd = qBound(targetStart + 1, qRound(i * factor), targetLength);
+        for (int j = targetStart; j < targetEnd; ++j) {
+            if (horizontal)
+                target.setPixel(j + 1, targetLine, 0xff000000);
+            else
+                target.setPixel(targetLine, j + 1, 0xff000000);
+        }
+        start = -1;
+    }
+}
+
+QImage qImagineScaleNinePatch(const QImage &image, qreal factor)
+{
+    const QImage source = image.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+    const QRect inside = source.rect().adjusted(1, 1, -1, -1);
+    const QSize size(qMax(1, qRound(inside.width() * factor)), qMax(1, qRound(inside.height() * factor)));
+    const QImage content = source.copy(inside).scaled(size, Qt::IgnoreAspectRatio, Qt::SmoothTransformation)
+            .convertToFormat(QImage::Format_ARGB32_Premultiplied);
+
+    QImage target(size + QSize(2, 2), QImage::Format_ARGB32_Premultiplied);
+    target.fill(0);
+    copyPixels(content, content.rect(), target, QPoint(1, 1));
+
+    scaleMarkers(source, target, true, 0, 0, factor);
+    scaleMarkers(source, target, true, source.height() - 1, target.height() - 1, factor);
+    scaleMarkers(source, target, false, 0, 0, factor);
+    scaleMarkers(source, target, false, source.width() - 1, target.width() - 1, factor);
+    return target;
+}
@@ -1,23 +1,55 @@
 #pragma once
 
+#include <QCache>
 #include <QImage>
+#include <QMutex>
 #include <QPainter>
 #include <QString>
+#include <QVector>
 #include <exception>
 #include <string>
 
+#include "stretchkernel.h"
+
+// What a render cache holds, and how often it was asked for a render it had (hits)
+// or had to render first (misses)
+struct QImagineRenderCacheStats {
+    int renderCount = 0;
+    qint64 renderBytes = 0;
+    qint64 hits = 0;
+    qint64 misses = 0;
+};
+
 class QImagineStyleImage {
 public:
     virtual ~QImagineStyleImage() {};
+    // Draws the image so that it fills the target rect
     virtual void draw(QPainter* painter, const QRect &targetRect) const = 0;
     virtual QSize size() const = 0;
+
+    // Draws the image into each of the target rects, which should not overlap. Implementations
+    // hand the rects to paint engines that draw pixmap fragments natively (OpenGL) in as few
+    // calls as they can, and draw them one by one on other engines.
+    virtual void drawBatch(QPainter *painter, const QVector<QRect> &targetRects) const;
+
+    // The decoded source, as loaded from file (including the markers of a nine-patch image)
+    virtual QImage image() const = 0;
+
+    // Renders up front whatever draw() needs for a target of the given size.
+    // Called from a worker thread, so implementations must be thread safe.
+    virtual void prepare(const QSize &targetSize) const { Q_UNUSED(targetSize); }
+
+    // Sets how stretched areas are sampled. Only has an effect on images that stretch.
+    virtual void setStretchQuality(QImagineStretchQuality quality) { Q_UNUSED(quality); }
 };
 
 class QImagineStyleFixedImage : public QImagineStyleImage {
 public:
     QImagineStyleFixedImage(const QPixmap &pixmap);
     void draw(QPainter *painter, const QRect &targetRect) const override;
+    void drawBatch(QPainter *painter, const QVector<QRect> &targetRects) const override;
     QSize size() const override;
+    QImage image() const override;
 
 public:
     QPixmap m_pixmap;
@@ -29,27 +61,91 @@ public:
     ~QStyleNinePatchImage();
 
     void draw(QPainter* painter, const QRect &targetRect) const override;
+    void drawBatch(QPainter *painter, const QVector<QRect> &targetRects) const override;
     QSize size() const override;
+    QImage image() const override;
+    void prepare(const QSize &targetSize) const override;
+    void setStretchQuality(QImagineStretchQuality quality) override;
+
+    // Sets how many device pixels the opaque interior of a render needs before draw() copies it
+    // and only blends the borders. Below that, the extra draw calls cost more than the blending
+    // they save. A negative area never copies.
+    void setOpaqueBlitArea(int pixels);
+
+    // Returns up to count of the cached renders, the most used first
+    QVector<QImage> mostUsedRenders(int count) const;
+    // Adds a render that was made earlier, for instance by a previous process
+    void insertRender(const QImage &render);
+    QImagineRenderCacheStats renderCacheStats() const;
 
 private:
+    struct Render {
+        QImage image;
+        QRect opaqueRect;
+        int hits = 0;
+    };
+
+    // A render converted for batched drawing, and the render it was made from
+    struct RenderPixmap {
+        qint64 imageKey;
+        QPixmap pixmap;
+    };
+
+    // A piece of the source image and where it goes in a render
+    struct Slice {
+        QRect source;
+        QRect target;
+        bool stretched;
+    };
+
+    // How a render of a given size is cut from the source image
+    struct Layout {
+        QVector<Slice> slices;
+        QRect opaqueRect;
+    };
+
     void updateContentArea();
     void updateResizeArea();
-    void getFactor(int width, int height, double& factorX, double& factorY);
-    void updateCachedImage(int width, int height);
-    void drawScaledPart(QRect oldRect, QRect newRect, QPainter& painter);
-    void drawConstPart(QRect oldRect, QRect newRect, QPainter& painter);
-    void setImageSize(int width, int height);
+    void updateOpaqueArea();
+    QSize pixelSize(const QSize &targetSize) const;
+    Render cachedRender(const QSize &pixelSize) const;
+    bool findRender(quint64 key, Render *render) const;
+    Render addRender(const QSize &pixelSize) const;
+    QPixmap renderPixmap(const QSize &pixelSize, const Render &render) const;
+    Layout cachedLayout(const QSize &pixelSize) const;
+    Layout computeLayout(const QSize &pixelSize) const;
+    QImage renderImage(const Layout &layout, const QSize &pixelSize) const;
+    void drawScaledPart(QRect oldRect, QRect newRect, QImage& image) const;
+    void drawConstPart(QRect oldRect, QRect newRect, QImage& image) const;
 
 private:
     QImage m_image;
-    QImage m_cachedImage;
+
+    // Renders keyed on pixel size, shared between painting and the pre-warm worker
+    mutable QMutex m_cacheMutex;
+    mutable QCache<quint64, Render> m_cachedImages;
+    mutable qint64 m_cacheHits = 0;
+    mutable qint64 m_cacheMisses = 0;
+    // Pixmaps of the renders keyed on pixel size. Only used by the GUI thread, which is the
+    // only thread that may touch pixmaps, so they are kept out of the shared cache.
+    mutable QCache<quint64, RenderPixmap> m_pixmaps;
+    // Layouts keyed on pixel size, so that renders that were evicted or came from the disk cache
+    // don't have to slice the image again
+    mutable QCache<quint64, Layout> m_layouts;
+    QImagineStretchQuality m_stretchQuality = QImagineStretchQuality::Bilinear;
+    int m_opaqueBlitArea;
 
     QVector<std::pair< int, int >> m_resizeDistancesX;
     QVector<std::pair< int, int >> m_resizeDistancesY;
 
     QRect m_contentArea;
+    QRect m_opaqueArea;
 };
 
+// Resamples a nine-patch image by factor, including its markers, which are kept one pixel wide and opaque.
+// Used to synthesize assets for fractional device pixel ratios from the assets of a higher ratio.
+QImage qImagineScaleNinePatch(const QImage &image, qreal factor);
+
 class NinePatchException : public std::exception {
 public:
     virtual const char* what() const throw() override {
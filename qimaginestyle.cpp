@@ -1 +1,4 @@
 #include "qimaginestyle.h"
+
+// Debug messages are off unless enabled with logging rules
+Q_LOGGING_CATEGORY(lcImagineStyle, "imaginestyle", QtInfoMsg)
@@ -1,159 +1,989 @@
 #ifndef QIMAGINESTYLE_H
 #define QIMAGINESTYLE_H
 
+#include <algorithm>
+
 #include <QApplication>
+#include <QtMath>
 #include <QScreen>
 #include <QProxyStyle>
+#include <QDateTime>
 #include <QDirIterator>
+#include <QFileInfo>
+#include <QFileSystemWatcher>
+#include <QImageReader>
+#include <QLoggingCategory>
+#include <QSet>
+#include <QAbstractSpinBox>
 #include <QStyleOption>
 #include <QPainter>
 #include <QComboBox>
+#include <QLineEdit>
+#include <QPointer>
+#include <QPushButton>
+#include <QRunnable>
+#include <QScopedPointer>
+#include <QScrollBar>
+#include <QSlider>
+#include <QSplitter>
+#include <QTabBar>
+#include <QThreadPool>
+#include <QTimer>
+#include <QVarLengthArray>
 
+#include "imaginediskcache.h"
+#include "imagineelements.h"
+#include "imaginevariants.h"
 #include "ninepatch.h"
 
+// What the style loaded, derived, synthesized and reloaded. Off by default; enable it with
+// QT_LOGGING_RULES="imaginestyle.debug=true".
+Q_DECLARE_LOGGING_CATEGORY(lcImagineStyle)
+
+class QImagineStylePrewarmTask : public QRunnable
+{
+public:
+    void append(const QImagineStyleImage *image, const QSize &targetSize)
+    {
+        m_jobs.append(qMakePair(image, targetSize));
+    }
+
+    void run() override
+    {
+        for (const auto &job : m_jobs)
+            job.first->prepare(job.second);
+    }
+
+    QVector<QPair<const QImagineStyleImage *, QSize>> m_jobs;
+};
+
 class QImagineStyle : public QProxyStyle
 {
   public:
 
-    QImagineStyle(const QString &imagePath)
+    enum Option {
+        NoOptions = 0x0,
+        // Don't load variants that qImagineVariantRule() can derive from another asset,
+        // but create them from that asset the first time they are drawn.
+        DeriveVariants = 0x1,
+        // Keep decoded assets and the most used nine-patch renders in a file under the user
+        // cache directory, so that the next launch neither decodes nor renders them again.
+        PersistentCache = 0x2,
+        // Watch a filesystem image path, and reload the assets that change on disk. Only the
+        // widgets that were drawn with those assets are repainted. Takes precedence over
+        // PersistentCache, since the assets are expected to change under us.
+        WatchImagePath = 0x4
+    };
+    Q_DECLARE_FLAGS(Options, Option)
+
+    struct LoadReport {
+        int imageCount = 0;
+        qint64 decodedBytes = 0;
+        int derivedCount = 0;
+        qint64 derivedBytesSaved = 0;
+        int cachedCount = 0;
+        int cachedRenderCount = 0;
+    };
+
+    struct CacheStats {
+        int imageCount = 0;
+        // Summed over the render caches of all nine-patch images
+        QImagineRenderCacheStats renders;
+    };
+
+    QImagineStyle(const QString &imagePath, Options options = NoOptions)
+        : m_options(options)
+        , m_imagePath(QDir::cleanPath(imagePath))
     {
-        // TODO: remove duplicates, only cache images of correct size (@2x, @3x etc).
-        QDirIterator it(imagePath, { "*.png" }, QDir::Files);
-        while (it.hasNext()) {
-            const QString fileName = it.next();
+        // A single worker is enough to stay ahead of the user, and leaves the other cores alone
+        m_prewarmPool.setMaxThreadCount(1);
 
-            const bool is2x = fileName.contains(QLatin1String("@2x"));
-            const bool is3x = fileName.contains(QLatin1String("@3x"));
-            const bool is9p = fileName.contains(QLatin1String(".9."));
+        const QStringList fileNames = imageFileNames();
+        QSet<QString> files;
+        for (const QString &fileName : fileNames)
+            files.insert(fileName);
 
-            if (is9p) {
-                try {
-                    // does this leak if exception is thrown?
-                    QImage image(fileName);
-                    image.setDevicePixelRatio(is2x ? 2.0 : is3x ? 3.0 : 1.0);
-                    m_images.insert(fileName, new QStyleNinePatchImage(image));
-                } catch (NinePatchException *exception) {
-                    qDebug() << "load, exception:" << exception->what();
-                }
-            } else {
-                QPixmap pixmap(fileName);
-                pixmap.setDevicePixelRatio(is2x ? 2.0 : is3x ? 3.0 : 1.0);
-                m_images.insert(fileName, new QImagineStyleFixedImage(pixmap));
+        // Resources can't change, so there is nothing to watch there
+        const bool watch = (m_options & WatchImagePath) && !m_imagePath.startsWith(QLatin1Char(':'));
+        if ((m_options & PersistentCache) && !watch)
+            m_diskCache.reset(new QImagineDiskCache(m_imagePath, fileNames, int(m_options)));
+
+        // TODO: remove duplicates, only cache images of correct size (@2x, @3x etc).
+        for (const QString &fileName : qAsConst(fileNames)) {
+            if ((m_options & DeriveVariants) && canDeriveImage(fileName, files)) {
+                const QSize size = QImageReader(fileName).size();
+                m_loadReport.derivedCount++;
+                m_loadReport.derivedBytesSaved += qint64(size.width()) * size.height() * 4;
+                continue;
             }
+
+            if (QImagineStyleImage *imagineImage = loadImage(fileName)) {
+                m_images.insert(fileName, imagineImage);
+                m_loadReport.imageCount++;
+                m_loadReport.decodedBytes += imagineImage->image().sizeInBytes();
+            }
+        }
+
+        if (m_diskCache)
+            restoreFromDiskCache();
+        m_elements.build(assetNames(fileNames));
+        if (watch)
+            watchImagePath(fileNames);
+
+        qCDebug(lcImagineStyle) << "load:" << m_loadReport.imageCount << "images,"
+                                << m_loadReport.decodedBytes / 1024 << "KiB decoded";
+        if (m_options & DeriveVariants) {
+            qCDebug(lcImagineStyle) << "load:" << m_loadReport.derivedCount << "variants derived on demand,"
+                                    << m_loadReport.derivedBytesSaved / 1024 << "KiB saved";
+        }
+        if (m_diskCache) {
+            qCDebug(lcImagineStyle) << "load:" << m_loadReport.cachedCount << "images and"
+                                    << m_loadReport.cachedRenderCount << "renders from the disk cache";
         }
     }
 
     ~QImagineStyle() {
+        m_prewarmPool.waitForDone();
         qDeleteAll(m_images);
     }
 
-    QImagineStyleImage *resolveImage(const QString &baseName, const QStyleOption *option, bool debug = false) const
+    // What the constructor loaded. Also logged to lcImagineStyle.
+    LoadReport loadReport() const
     {
-        Q_UNUSED(option);
-        // try with different endings, .9., @2x. etc, and append .png
+        return m_loadReport;
+    }
+
+    CacheStats cacheStats() const
+    {
+        CacheStats stats;
+        stats.imageCount = m_images.size();
+        for (const QImagineStyleImage *image : qAsConst(m_images)) {
+            const auto *ninePatch = dynamic_cast<const QStyleNinePatchImage *>(image);
+            if (!ninePatch)
+                continue;
+            const QImagineRenderCacheStats renders = ninePatch->renderCacheStats();
+            stats.renders.renderCount += renders.renderCount;
+            stats.renders.renderBytes += renders.renderBytes;
+            stats.renders.hits += renders.hits;
+            stats.renders.misses += renders.misses;
+        }
+        return stats;
+    }
+
+    // Draws the primitive into each of the rects, in the state that the option describes, resolving
+    // the asset once. Paint engines that draw pixmap fragments natively get one call per render;
+    // the raster engine draws the rects one by one. Meant for item delegates and grids that paint
+    // many equal indicators or backgrounds, since item views call the style once per item. Returns
+    // false when no asset draws the primitive alone, and the caller should draw it rect by rect.
+    bool drawPrimitiveBatch(PrimitiveElement element, const QStyleOption *option, const QVector<QRect> &rects,
+                            QPainter *painter, const QWidget *widget = nullptr) const
+    {
+        Q_UNUSED(widget);
+        for (const QImagineElementRule *rule : m_elements.rules(QImagineElementRule::Primitive, element)) {
+            if (!QImagineElementMap::applies(*rule, option))
+                continue;
+            if ((rule->flags & QImagineElementRule::SkipFrameless) && QImagineElementMap::isFrameless(option))
+                return true;
+            QImagineStyleImage *imagineImage = resolveRule(*rule, option);
+            if (!imagineImage)
+                continue;
+            if (rule->flags & QImagineElementRule::KeepBasePart)
+                return false;
+
+            QVector<QRect> imageRects;
+            imageRects.reserve(rects.size());
+            for (const QRect &rect : rects)
+                imageRects.append(imageRect(*rule, imagineImage, rect));
+            imagineImage->drawBatch(painter, imageRects);
+            return true;
+        }
+        return false;
+    }
+
+    void setStretchQuality(QImagineStretchQuality quality)
+    {
+        // Don't let a render on the pre-warm worker mix the old and the new quality
+        m_prewarmPool.waitForDone();
+        m_stretchQuality = quality;
+        for (QImagineStyleImage *image : qAsConst(m_images))
+            image->setStretchQuality(quality);
+        // Which also dropped the renders of every image
+        m_prewarmed.clear();
+    }
 
+    // -----------------------------------------------------------------------
+
+    QStringList imageFileNames() const
+    {
+        QStringList fileNames;
+        QDirIterator it(m_imagePath, { "*.png" }, QDir::Files);
+        while (it.hasNext())
+            fileNames.append(it.next());
+        return fileNames;
+    }
+
+    static QStringList assetNames(const QStringList &fileNames)
+    {
+        QSet<QString> names;
+        for (const QString &fileName : fileNames)
+            names.insert(assetName(fileName));
+        return names.values();
+    }
+
+    static QString assetName(const QString &fileName)
+    {
+        // ":/images/button-background-checked@2x.9.png" -> "button-background-checked"
+        const QString name = fileName.mid(fileName.lastIndexOf(QLatin1Char('/')) + 1);
+        const int scale = name.indexOf(QLatin1Char('@'));
+        return name.left(scale != -1 ? scale : name.indexOf(QLatin1Char('.')));
+    }
+
+    static QString renameAsset(const QString &fileName, const QString &assetName)
+    {
+        // Keeps the directory, scale and extension
+        const int start = fileName.lastIndexOf(QLatin1Char('/')) + 1;
+        return fileName.left(start) + assetName + fileName.mid(start + QImagineStyle::assetName(fileName).length());
+    }
+
+    QImagineStyleImage *createImage(QImage image, bool is9p) const
+    {
+        QImagineStyleImage *imagineImage = nullptr;
+        if (is9p) {
+            try {
+                // does this leak if exception is thrown?
+                imagineImage = new QStyleNinePatchImage(image);
+            } catch (NinePatchException *exception) {
+                qDebug() << "load, exception:" << exception->what();
+                return nullptr;
+            }
+        } else {
+            imagineImage = new QImagineStyleFixedImage(QPixmap::fromImage(image));
+        }
+        imagineImage->setStretchQuality(m_stretchQuality);
+        return imagineImage;
+    }
+
+    QImagineStyleImage *loadImage(const QString &fileName)
+    {
+        const bool is9p = fileName.contains(QLatin1String(".9."));
+
+        if (m_diskCache) {
+            const QImage cachedImage = m_diskCache->asset(fileName);
+            if (!cachedImage.isNull()) {
+                m_loadReport.cachedCount++;
+                return createImage(cachedImage, is9p);
+            }
+        }
+
+        QImage image(fileName);
+        image.setDevicePixelRatio(scaleFromFileName(fileName));
+        return createImage(image, is9p);
+    }
+
+    // -----------------------------------------------------------------------
+
+    static QString renderSignature(const QString &fileName, const QSize &size)
+    {
+        return fileName + QLatin1Char(':') + QString::number(size.width()) + QLatin1Char('x') + QString::number(size.height());
+    }
+
+    void restoreFromDiskCache()
+    {
+        // Add the derived and synthesized assets of the previous run, which have no file
+        const QStringList cachedFileNames = m_diskCache->assetFileNames();
+        for (const QString &fileName : cachedFileNames) {
+            m_diskCacheSignature.insert(fileName);
+            if (m_images.contains(fileName))
+                continue;
+            if (QImagineStyleImage *imagineImage = createImage(m_diskCache->asset(fileName), fileName.contains(QLatin1String(".9.")))) {
+                m_images.insert(fileName, imagineImage);
+                m_loadReport.cachedCount++;
+            }
+        }
+
+        const auto renders = m_diskCache->renders();
+        for (auto it = renders.cbegin(); it != renders.cend(); ++it) {
+            auto *ninePatch = dynamic_cast<QStyleNinePatchImage *>(m_images.value(it.key()));
+            if (!ninePatch)
+                continue;
+            for (const QImage &render : it.value()) {
+                ninePatch->insertRender(render);
+                m_diskCacheSignature.insert(renderSignature(it.key(), render.size()));
+                m_loadReport.cachedRenderCount++;
+            }
+        }
+
+        // Everything is shared with the images now, so there is no need to hold on to it
+        m_diskCache->clear();
+    }
+
+    void saveDiskCache()
+    {
+        // Renders made with another quality than the default would be thrown away on the next launch
+        static const int maxRendersPerImage = 4;
+        const bool saveRenders = m_stretchQuality == QImagineStretchQuality::Bilinear;
+
+        QVector<QImagineDiskCache::Entry> entries;
+        QSet<QString> signature;
+        for (auto it = m_images.cbegin(); it != m_images.cend(); ++it) {
+            entries.append({ it.key(), it.value()->image(), false });
+            signature.insert(it.key());
+            const auto *ninePatch = dynamic_cast<const QStyleNinePatchImage *>(it.value());
+            if (!ninePatch || !saveRenders)
+                continue;
+            for (const QImage &render : ninePatch->mostUsedRenders(maxRendersPerImage)) {
+                entries.append({ it.key(), render, true });
+                signature.insert(renderSignature(it.key(), render.size()));
+            }
+        }
+
+        // Only write when something changed since the file was read
+        if (signature == m_diskCacheSignature)
+            return;
+        m_diskCacheSignature = signature;
+        m_diskCache->save(entries, &m_prewarmPool);
+    }
+
+    // -----------------------------------------------------------------------
+
+    void watchImagePath(const QStringList &fileNames)
+    {
+        // Saving a single file tends to cause a burst of notifications,
+        // so wait for things to settle down before reloading
+        static const int reloadDelay = 100;
+        m_reloadTimer.setSingleShot(true);
+        m_reloadTimer.setInterval(reloadDelay);
+        connect(&m_reloadTimer, &QTimer::timeout, this, [this] { reloadImages(); });
+
+        for (const QString &fileName : fileNames)
+            m_fileTimes.insert(fileName, QFileInfo(fileName).lastModified());
+
+        m_watcher.reset(new QFileSystemWatcher);
+        m_watcher->addPath(m_imagePath);
+        if (!fileNames.isEmpty())
+            m_watcher->addPaths(fileNames);
+        connect(m_watcher.data(), &QFileSystemWatcher::fileChanged, this, [this](const QString &fileName) {
+            m_pendingReloads.insert(fileName);
+            m_reloadTimer.start();
+        });
+        connect(m_watcher.data(), &QFileSystemWatcher::directoryChanged, this, [this] {
+            m_reloadTimer.start();
+        });
+    }
+
+    void reloadImages()
+    {
+        // Compare against the last scan, which also catches files that were added or removed
+        QSet<QString> changed;
+        changed.swap(m_pendingReloads);
+        // Any of them can be the file that a missing image was looked for in
+        m_missingImages.clear();
+        bool added = false;
+        const QStringList fileNames = imageFileNames();
+        QSet<QString> files;
+        QHash<QString, QDateTime> fileTimes;
+        for (const QString &fileName : fileNames) {
+            const QDateTime time = QFileInfo(fileName).lastModified();
+            const auto previous = m_fileTimes.constFind(fileName);
+            if (previous == m_fileTimes.constEnd()) {
+                changed.insert(fileName);
+                added = true;
+            } else if (previous.value() != time) {
+                changed.insert(fileName);
+            }
+            files.insert(fileName);
+            fileTimes.insert(fileName, time);
+        }
+        bool removed = false;
+        for (auto it = m_fileTimes.cbegin(); it != m_fileTimes.cend(); ++it) {
+            if (!files.contains(it.key())) {
+                changed.insert(it.key());
+                removed = true;
+            }
+        }
+        m_fileTimes = fileTimes;
+
+        // Editors that save by replacing the file make the watcher forget about it
+        QSet<QString> watchedFiles;
+        for (const QString &fileName : m_watcher->files())
+            watchedFiles.insert(fileName);
+        for (const QString &fileName : fileNames) {
+            if (!watchedFiles.contains(fileName))
+                m_watcher->addPath(fileName);
+        }
+
+        if (changed.isEmpty())
+            return;
+
+        // The worker might be rendering one of the images that are about to be deleted
+        m_prewarmPool.waitForDone();
+
+        // Derived and synthesized images have to follow the image they were made from
+        QSet<QString> stale = changed;
+        for (bool grew = true; grew; ) {
+            grew = false;
+            for (auto it = m_imageSources.cbegin(); it != m_imageSources.cend(); ++it) {
+                if (stale.contains(it.value()) && !stale.contains(it.key())) {
+                    stale.insert(it.key());
+                    grew = true;
+                }
+            }
+        }
+
+        // Deleting an image drops all of its renders
+        QSet<QWidget *> widgets;
+        int dropped = 0;
+        for (const QString &fileName : qAsConst(stale)) {
+            m_imageSources.remove(fileName);
+            QImagineStyleImage *imagineImage = m_images.take(fileName);
+            if (!imagineImage)
+                continue;
+            widgets += takeImageUsers(imagineImage);
+            delete imagineImage;
+            dropped++;
+        }
+        // A new image can get the address of one that was deleted
+        if (dropped)
+            m_prewarmed.clear();
+
+        int reloaded = 0;
+        for (const QString &fileName : qAsConst(changed)) {
+            if (!files.contains(fileName))
+                continue;
+            if ((m_options & DeriveVariants) && canDeriveImage(fileName, files))
+                continue;
+            if (QImagineStyleImage *imagineImage = loadImage(fileName)) {
+                m_images.insert(fileName, imagineImage);
+                reloaded++;
+            }
+        }
+
+        // A new file can replace a fallback or synthesized image anywhere, so repaint everything then
+        if (added || removed)
+            m_elements.build(assetNames(fileNames));
+        if (added) {
+            for (QWidget *widget : QApplication::allWidgets())
+                widgets.insert(widget);
+        }
+
+        int repainted = 0;
+        for (QWidget *widget : qAsConst(widgets)) {
+            // The size hints of most controls come from the image size
+            widget->updateGeometry();
+            widget->update();
+            repainted++;
+        }
+
+        qCDebug(lcImagineStyle) << "reload:" << changed.size() << "files changed," << reloaded << "images reloaded,"
+                                << dropped << "images dropped," << repainted << "widgets repainted";
+    }
+
+    bool canDeriveImage(const QString &fileName, const QSet<QString> &files) const
+    {
+        // The chain of variants has to end in a file, like "-mirrored-disabled" -> "-mirrored" -> file
+        QString sourceName;
+        if (!qImagineVariantRule(assetName(fileName), &sourceName))
+            return false;
+        const QString sourceFileName = renameAsset(fileName, sourceName);
+        return files.contains(sourceFileName) || canDeriveImage(sourceFileName, files);
+    }
+
+    QImagineStyleImage *deriveImage(const QString &fileName) const
+    {
+        QString sourceName;
+        const QImagineVariantRule *rule = qImagineVariantRule(assetName(fileName), &sourceName);
+        if (!rule)
+            return nullptr;
+
+        const QString sourceFileName = renameAsset(fileName, sourceName);
+        QImagineStyleImage *source = m_images.value(sourceFileName);
+        if (!source)
+            source = deriveImage(sourceFileName);
+        if (!source)
+            return nullptr;
+
+        const QImage sourceImage = source->image();
+        const bool is9p = fileName.contains(QLatin1String(".9."));
+        QImage image = qImagineDeriveVariant(sourceImage, *rule, is9p);
+        image.setDevicePixelRatio(sourceImage.devicePixelRatio());
+
+        QImagineStyleImage *imagineImage = createImage(image, is9p);
+        if (imagineImage) {
+            m_images.insert(fileName, imagineImage);
+            m_imageSources.insert(fileName, sourceFileName);
+        }
+        return imagineImage;
+    }
+
+    static QString scaleSuffix(qreal scale)
+    {
+        // 1.0 -> "", 2.0 -> "@2x", 1.25 -> "@1.25x"
+        if (qFuzzyCompare(scale, 1.0))
+            return QString();
+        return QLatin1Char('@') + QString::number(scale) + QLatin1Char('x');
+    }
+
+    static qreal scaleFromFileName(const QString &fileName)
+    {
+        const int at = fileName.lastIndexOf(QLatin1Char('@'));
+        if (at == -1)
+            return 1.0;
+        bool ok = false;
+        const qreal scale = fileName.mid(at + 1, fileName.indexOf(QLatin1Char('x'), at) - at - 1).toDouble(&ok);
+        return ok && scale > 0 ? scale : 1.0;
+    }
+
+    QImagineStyleImage *lookupImage(const QString &baseName, const QString &scale, bool debug) const
+    {
         static const QString nine = QStringLiteral(".9");
         static const QString png = QStringLiteral(".png");
-        static const QString scale2x = QStringLiteral("@2x");
-
-        // Works for now, but scale factor should really be depending on QPainter paint device dpr?
-        QString scale;
-        const int dpr = qApp->primaryScreen()->devicePixelRatio();
-        if (dpr == 2)
-            scale = scale2x;
 
         QString fileName = baseName + scale + nine + png;
         if (debug)
             qDebug() << "trying:" << fileName;
-        if (const auto imagineImage = m_images[fileName])
+        if (const auto imagineImage = m_images.value(fileName))
             return imagineImage;
 
         fileName = baseName + scale + png;
         if (debug)
             qDebug() << "trying:" << fileName;
-        if (const auto imagineImage = m_images[fileName])
+        if (const auto imagineImage = m_images.value(fileName))
+            return imagineImage;
+
+        if (m_options & DeriveVariants) {
+            if (const auto imagineImage = deriveImage(baseName + scale + nine + png))
+                return imagineImage;
+            if (const auto imagineImage = deriveImage(fileName))
+                return imagineImage;
+        }
+
+        return nullptr;
+    }
+
+    QImagineStyleImage *synthesizeImage(const QString &baseName, qreal dpr, bool debug) const
+    {
+        // Downsample the nearest asset drawn for a higher scale, once, rather than
+        // letting the painter upscale the 1x asset on every draw
+        static const int maxAssetScale = 4;
+        for (int sourceScale = qCeil(dpr); sourceScale <= maxAssetScale; ++sourceScale) {
+            const QImagineStyleImage *source = lookupImage(baseName, scaleSuffix(sourceScale), debug);
+            if (!source)
+                continue;
+
+            const QImage sourceImage = source->image();
+            const bool is9p = dynamic_cast<const QStyleNinePatchImage *>(source);
+            const qreal factor = dpr / sourceScale;
+            QImage image;
+            if (is9p) {
+                image = qImagineScaleNinePatch(sourceImage, factor);
+            } else {
+                const QSize size(qMax(1, qRound(sourceImage.width() * factor)), qMax(1, qRound(sourceImage.height() * factor)));
+                image = sourceImage.scaled(size, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+            }
+            image.setDevicePixelRatio(dpr);
+
+            const QString fileName = baseName + scaleSuffix(dpr) + (is9p ? QStringLiteral(".9.png") : QStringLiteral(".png"));
+            qCDebug(lcImagineStyle) << "synthesized:" << fileName << "from scale" << sourceScale;
+            QImagineStyleImage *imagineImage = createImage(image, is9p);
+            if (imagineImage) {
+                m_images.insert(fileName, imagineImage);
+                m_imageSources.insert(fileName, m_images.key(const_cast<QImagineStyleImage *>(source)));
+            }
             return imagineImage;
+        }
+        return nullptr;
+    }
+
+    QImagineStyleImage *resolveImage(const QString &baseName, const QStyleOption *option, bool debug = false) const
+    {
+        QImagineStyleImage *imagineImage = findImage(baseName, debug);
+
+        // Remember who uses the image, so that a reload only needs to repaint those widgets
+        if (imagineImage && m_watcher) {
+            if (QWidget *widget = qobject_cast<QWidget *>(option->styleObject))
+                addImageUser(imagineImage, widget);
+        }
+        return imagineImage;
+    }
+
+    void addImageUser(const QImagineStyleImage *image, QWidget *widget) const
+    {
+        QSet<QWidget *> &users = m_imageUsers[image];
+        if (users.contains(widget))
+            return;
+        users.insert(widget);
+
+        // Forget the widget as soon as it goes, rather than at the next reload
+        if (!m_userImages.contains(widget))
+            connect(widget, &QObject::destroyed, this, [this, widget] { removeImageUser(widget); });
+        m_userImages[widget].append(image);
+    }
+
+    void removeImageUser(QWidget *widget) const
+    {
+        const auto images = m_userImages.take(widget);
+        for (const QImagineStyleImage *image : images) {
+            const auto it = m_imageUsers.find(image);
+            if (it == m_imageUsers.end())
+                continue;
+            it->remove(widget);
+            if (it->isEmpty())
+                m_imageUsers.erase(it);
+        }
+    }
+
+    QSet<QWidget *> takeImageUsers(const QImagineStyleImage *image) const
+    {
+        const QSet<QWidget *> users = m_imageUsers.take(image);
+        for (QWidget *widget : users) {
+            const auto it = m_userImages.find(widget);
+            if (it == m_userImages.end())
+                continue;
+            // An empty entry is kept, since the widget is still connected
+            it->removeAll(image);
+        }
+        return users;
+    }
+
+    QImagineStyleImage *findImage(const QString &baseName, bool debug) const
+    {
+        // try with different endings, .9., @2x. etc, and append .png
+
+        // Works for now, but scale factor should really be depending on QPainter paint device dpr?
+        const qreal dpr = qApp->primaryScreen()->devicePixelRatio();
+        const QString scale = scaleSuffix(dpr);
+
+        // A name without an asset would otherwise try each of its file names, and stat
+        // them, on every paint
+        const QString missingKey = baseName + scale;
+        if (m_missingImages.contains(missingKey))
+            return nullptr;
+
+        if (const auto imagineImage = lookupImage(baseName, scale, debug))
+            return imagineImage;
+
+        if (!scale.isEmpty()) {
+            if (dpr != qFloor(dpr)) {
+                if (const auto imagineImage = synthesizeImage(baseName, dpr, debug))
+                    return imagineImage;
+            }
+            if (const auto imagineImage = lookupImage(baseName, QString(), debug))
+                return imagineImage;
+        }
 
         if (debug)
             qDebug() << "no image found:" << baseName;
 
+        m_missingImages.insert(missingKey);
         return nullptr;
     }
 
     // -----------------------------------------------------------------------
 
+    using QProxyStyle::polish;
+    using QProxyStyle::unpolish;
+
     void polish(QPalette &palette) override
     {
         palette.setColor(QPalette::Window, Qt::white);
     }
 
+    static constexpr const char *hoverSetProperty = "_q_imagine_setHover";
+
+    static bool hasHoveredAssets(const QWidget *widget)
+    {
+        return qobject_cast<const QAbstractButton *>(widget)
+                || qobject_cast<const QComboBox *>(widget)
+                || qobject_cast<const QAbstractSpinBox *>(widget)
+                || qobject_cast<const QScrollBar *>(widget)
+                || qobject_cast<const QSlider *>(widget)
+                || qobject_cast<const QSplitterHandle *>(widget)
+                || qobject_cast<const QTabBar *>(widget);
+    }
+
+    void polish(QWidget *widget) override
+    {
+        QProxyStyle::polish(widget);
+        if (widget->isWindow())
+            widget->installEventFilter(this);
+        // Widgets only get State_MouseOver with WA_Hover. Remember whether it was us who set
+        // it, so that unpolish() leaves it alone on widgets that asked for it themselves.
+        if (hasHoveredAssets(widget) && !widget->testAttribute(Qt::WA_Hover)) {
+            widget->setAttribute(Qt::WA_Hover);
+            widget->setProperty(hoverSetProperty, true);
+        }
+    }
+
+    void unpolish(QWidget *widget) override
+    {
+        if (widget->isWindow())
+            widget->removeEventFilter(this);
+        if (widget->property(hoverSetProperty).toBool()) {
+            widget->setAttribute(Qt::WA_Hover, false);
+            widget->setProperty(hoverSetProperty, QVariant());
+        }
+        QProxyStyle::unpolish(widget);
+    }
+
+    bool eventFilter(QObject *watched, QEvent *event) override
+    {
+        if (event->type() == QEvent::Show) {
+            QWidget *window = qobject_cast<QWidget *>(watched);
+            // Menus, combo box popups and tooltips are shown over and over, and have no
+            // widgets that are pressed or focused
+            const bool transient = window && (window->windowType() == Qt::Popup || window->windowType() == Qt::ToolTip);
+            if (window && !transient) {
+                // Wait for the event loop to become idle, so that we don't delay the first frame
+                const QPointer<QWidget> guard(window);
+                QTimer::singleShot(0, this, [this, guard] {
+                    if (guard)
+                        prewarm(guard);
+                });
+
+                // Give the user some time to use the window before picking the renders to keep
+                static const int diskCacheSaveDelay = 10000;
+                if (m_diskCache && !m_diskCacheSaveScheduled) {
+                    m_diskCacheSaveScheduled = true;
+                    QTimer::singleShot(diskCacheSaveDelay, this, [this] {
+                        m_diskCacheSaveScheduled = false;
+                        saveDiskCache();
+                    });
+                }
+            }
+        }
+        return QProxyStyle::eventFilter(watched, event);
+    }
+
+    // -----------------------------------------------------------------------
+
+    void addPrewarmJob(QImagineStylePrewarmTask *task, const QImagineStyleImage *image, const QSize &size)
+    {
+        // A window that is shown again only queues the sizes that it didn't have before
+        const auto job = qMakePair(image, (quint64(size.width()) << 32) | quint32(size.height()));
+        if (m_prewarmed.contains(job))
+            return;
+        m_prewarmed.insert(job);
+        task->append(image, size);
+    }
+
+    void prewarmButton(QStyleOptionButton &option, QImagineStylePrewarmTask *task, bool checkable)
+    {
+        const char *family = option.features & QStyleOptionButton::Flat ? "button-background-flat" : "button-background";
+        const State normalState = option.state;
+        for (const StateFlag state : { State_Sunken, State_HasFocus, State_On }) {
+            if (state == State_On && !checkable)
+                continue;
+            option.state = normalState | state;
+            if (const auto imagineImage = resolveFamily(family, &option))
+                addPrewarmJob(task, imagineImage, option.rect.size());
+        }
+    }
+
+    void prewarm(QWidget *window)
+    {
+        // Render the nine-patch variants that the visible widgets will need once the user starts to
+        // interact with them, so that the first press or focus change is as fast as the next one.
+        // Fixed images need no rendering, so only widgets drawn with nine-patch images are handled.
+        auto *task = new QImagineStylePrewarmTask;
+        const auto widgets = window->findChildren<QWidget *>();
+        for (QWidget *widget : widgets) {
+            if (!widget->isVisible())
+                continue;
+
+            if (const auto *button = qobject_cast<QPushButton *>(widget)) {
+                QStyleOptionButton option;
+                option.initFrom(button);
+                if (button->isFlat())
+                    option.features |= QStyleOptionButton::Flat;
+                if (button->isDefault())
+                    option.features |= QStyleOptionButton::DefaultButton;
+                prewarmButton(option, task, button->isCheckable());
+            } else if (const auto *lineEdit = qobject_cast<QLineEdit *>(widget)) {
+                // Line edits without a frame are part of a combo box or spin box
+                if (!lineEdit->hasFrame())
+                    continue;
+                QStyleOptionFrame option;
+                option.initFrom(lineEdit);
+                option.state |= State_HasFocus;
+                if (const auto imagineImage = resolveFamily("textfield-background", &option))
+                    addPrewarmJob(task, imagineImage, option.rect.size());
+            } else if (const auto *comboBox = qobject_cast<QComboBox *>(widget)) {
+                QStyleOptionComboBox option;
+                option.initFrom(comboBox);
+                option.editable = comboBox->isEditable();
+                option.state |= State_HasFocus;
+                if (const auto imagineImage = resolveFamily("combobox-background", &option))
+                    addPrewarmJob(task, imagineImage, option.rect.size());
+            }
+        }
+
+        if (task->m_jobs.isEmpty()) {
+            delete task;
+            return;
+        }
+        m_prewarmPool.start(task);
+    }
+
     // -----------------------------------------------------------------------
 
-    QString baseNameButton(const QString &subType, const QStyleOptionButton *option) const
+    QImagineStyleImage *resolveAsset(const QString &family, QImagineAsset::States states, const QStyleOption *option) const
+    {
+        const QString assetName = m_elements.assetName(family, states);
+        if (assetName.isEmpty())
+            return nullptr;
+        return resolveImage(m_imagePath + QLatin1Char('/') + assetName, option);
+    }
+
+    QImagineStyleImage *resolveFamily(const char *family, const QStyleOption *option) const
     {
-        QString fileName = QStringLiteral(":/images/%1").arg(subType);
-        if (option->state & QStyle::State_Sunken) {
-            fileName += QLatin1String("-pressed");
+        return resolveAsset(QLatin1String(family), QImagineElementMap::states(option), option);
+    }
+
+    QImagineStyleImage *resolveRule(const QImagineElementRule &rule, const QStyleOption *option) const
+    {
+        return resolveAsset(QLatin1String(rule.family), QImagineElementMap::states(option, &rule), option);
+    }
+
+    QRect elementRect(const QImagineElementRule &rule, const QStyleOption *option, const QWidget *widget) const
+    {
+        QRect rect = option->rect;
+        if (rule.kind == QImagineElementRule::ComplexControl && rule.placement != QImagineElementRule::OptionRect) {
+            const auto *complexOption = qstyleoption_cast<const QStyleOptionComplex *>(option);
+            rect = proxy()->subControlRect(ComplexControl(rule.element), complexOption, SubControl(int(rule.part)), widget);
+        }
+        if (rule.placement != QImagineElementRule::ValueProgress)
+            return rect;
+
+        qint64 minimum = 0;
+        qint64 maximum = 0;
+        qint64 value = 0;
+        if (const auto *sliderOption = qstyleoption_cast<const QStyleOptionSlider *>(option)) {
+            minimum = sliderOption->minimum;
+            maximum = sliderOption->maximum;
+            value = sliderOption->sliderValue;
+        } else if (const auto *progressOption = qstyleoption_cast<const QStyleOptionProgressBar *>(option)) {
+            minimum = progressOption->minimum;
+            maximum = progressOption->maximum;
+            value = progressOption->progress;
+        }
+        const qreal scale = qBound<qreal>(0, qreal(value - minimum) / qMax<qint64>(1, maximum - minimum), 1);
+        if (option->state & State_Horizontal) {
+            rect.setWidth(qRound(rect.width() * scale));
         } else {
-            if (option->state & QStyle::State_On)
-                fileName += QStringLiteral("-checked");
-            if (option->state & QStyle::State_HasFocus)
-                fileName += QStringLiteral("-focused");
+            // Vertical values grow from the bottom
+            rect.setTop(rect.bottom() + 1 - qRound(rect.height() * scale));
         }
-        return fileName;
+        return rect;
+    }
+
+    static QRect imageRect(const QImagineElementRule &rule, const QImagineStyleImage *image, const QRect &rect)
+    {
+        if (rule.flags & QImagineElementRule::NaturalSize)
+            return QRect(rect.topLeft(), image->size());
+        return rect;
     }
 
-    QString baseNameSliderBackground(const QStyleOptionSlider *option) const
+    bool drawElement(QImagineElementRule::Kind kind, int element, const QStyleOption *option, QPainter *painter, const QWidget *widget) const
     {
-        QString fileName = QStringLiteral(":/images/slider-background");
-        if (option->state & QStyle::State_Horizontal)
-            fileName += QStringLiteral("-horizontal");
-        return fileName;
+        for (const QImagineElementRule *rule : m_elements.rules(kind, element)) {
+            if (!QImagineElementMap::applies(*rule, option))
+                continue;
+            if ((rule->flags & QImagineElementRule::SkipFrameless) && QImagineElementMap::isFrameless(option))
+                return true;
+            QImagineStyleImage *imagineImage = resolveRule(*rule, option);
+            if (!imagineImage)
+                continue;
+
+            imagineImage->draw(painter, imageRect(*rule, imagineImage, elementRect(*rule, option, widget)));
+            if (rule->flags & QImagineElementRule::KeepBasePart)
+                drawBaseElement(*rule, option, painter, widget);
+            return true;
+        }
+        return false;
     }
 
-    QString baseNameSliderProgress(const QStyleOptionSlider *option) const
+    void drawBaseElement(const QImagineElementRule &rule, const QStyleOption *option, QPainter *painter, const QWidget *widget) const
     {
-        QString fileName = QStringLiteral(":/images/slider-progress");
-        if (option->state & QStyle::State_Horizontal)
-            fileName += QStringLiteral("-horizontal");
-        return fileName;
+        if (rule.kind == QImagineElementRule::Primitive) {
+            QProxyStyle::drawPrimitive(PrimitiveElement(rule.element), option, painter, widget);
+        } else if (const auto *menuItemOption = qstyleoption_cast<const QStyleOptionMenuItem *>(option)) {
+            // The asset shows the selection already, so don't let the base style fill it in again
+            QStyleOptionMenuItem unselectedOption(*menuItemOption);
+            unselectedOption.state &= ~State_Selected;
+            QProxyStyle::drawControl(ControlElement(rule.element), &unselectedOption, painter, widget);
+        } else {
+            QProxyStyle::drawControl(ControlElement(rule.element), option, painter, widget);
+        }
     }
 
-    QString baseNameSliderHandle(const QStyleOptionSlider *option) const
+    typedef QVarLengthArray<QPair<const QImagineElementRule *, QImagineStyleImage *>, 8> ResolvedParts;
+
+    // Resolves every part before any is drawn or measured, so that a control that lacks an
+    // asset is left to the base style as a whole, instead of mixing the looks
+    bool resolveParts(ComplexControl control, const QStyleOptionComplex *option, SubControls subControls,
+                      ResolvedParts *parts, SubControls *handledParts) const
     {
-        QString fileName = QStringLiteral(":/images/slider-handle");
-        if (option->state & QStyle::State_Sunken)
-            fileName += QLatin1String("-pressed");
-        return fileName;
+        for (const QImagineElementRule *rule : m_elements.rules(QImagineElementRule::ComplexControl, control)) {
+            if (!(subControls & rule->part) || !QImagineElementMap::applies(*rule, option))
+                continue;
+            if (rule->family) {
+                QImagineStyleImage *imagineImage = resolveRule(*rule, option);
+                if (!imagineImage) {
+                    if (rule->flags & QImagineElementRule::OptionalPart)
+                        continue;
+                    return false;
+                }
+                parts->append(qMakePair(rule, imagineImage));
+            }
+            if (!(rule->flags & QImagineElementRule::KeepBasePart))
+                *handledParts |= rule->part;
+        }
+        return !parts->isEmpty();
     }
 
-    QString baseNameTextInput(const QStyleOptionFrame *option) const
+    bool drawComplexElement(ComplexControl control, const QStyleOptionComplex *option, QPainter *painter, const QWidget *widget) const
     {
-        Q_UNUSED(option);
-        QString fileName = QStringLiteral(":/images/textfield-background");
-        if (option->state & QStyle::State_HasFocus)
-            fileName += QStringLiteral("-focused");
-        return fileName;
+        ResolvedParts parts;
+        SubControls handledParts = SC_None;
+        if (!resolveParts(control, option, option->subControls, &parts, &handledParts))
+            return false;
+
+        // Consecutive parts that show the same asset are drawn in one batch
+        QVector<QRect> rects;
+        for (int i = 0; i < parts.size(); ++i) {
+            rects.append(imageRect(*parts[i].first, parts[i].second, elementRect(*parts[i].first, option, widget)));
+            if (i + 1 < parts.size() && parts[i + 1].second == parts[i].second)
+                continue;
+            parts[i].second->drawBatch(painter, rects);
+            rects.clear();
+        }
+
+        const SubControls baseParts = option->subControls & ~handledParts;
+        if (baseParts)
+            drawBaseParts(control, option, baseParts, painter, widget);
+        return true;
     }
 
-    QString baseNameComboBoxBackground(const QStyleOptionComboBox *option) const
+    template <typename Option>
+    void drawBasePartsAs(ComplexControl control, Option option, SubControls parts, QPainter *painter, const QWidget *widget) const
     {
-        Q_UNUSED(option);
-        QString fileName = QStringLiteral(":/images/combobox-background");
-        if (option->editable)
-            fileName += QStringLiteral("-editable");
-        if (option->state & QStyle::State_HasFocus)
-            fileName += QStringLiteral("-focused");
-        return fileName;
+        option.subControls = parts;
+        QProxyStyle::drawComplexControl(control, &option, painter, widget);
     }
 
-    QString baseNameComboBoxIndicator(const QStyleOptionComboBox *option) const
+    void drawBaseParts(ComplexControl control, const QStyleOptionComplex *option, SubControls parts, QPainter *painter, const QWidget *widget) const
     {
-        Q_UNUSED(option);
-        QString fileName = QStringLiteral(":/images/combobox-indicator");
-        if (option->editable)
-            fileName += QStringLiteral("-editable");
-        return fileName;
+        // The copy has to keep the type of the option, since the base style casts it back
+        if (const auto *sliderOption = qstyleoption_cast<const QStyleOptionSlider *>(option))
+            drawBasePartsAs(control, *sliderOption, parts, painter, widget);
+        else if (const auto *spinBoxOption = qstyleoption_cast<const QStyleOptionSpinBox *>(option))
+            drawBasePartsAs(control, *spinBoxOption, parts, painter, widget);
+        else if (const auto *comboOption = qstyleoption_cast<const QStyleOptionComboBox *>(option))
+            drawBasePartsAs(control, *comboOption, parts, painter, widget);
+        else if (const auto *groupBoxOption = qstyleoption_cast<const QStyleOptionGroupBox *>(option))
+            drawBasePartsAs(control, *groupBoxOption, parts, painter, widget);
+        else
+            drawBasePartsAs(control, *option, parts, painter, widget);
     }
 
 // -----------------------------------------------------------------------
@@ -164,42 +994,8 @@ class QImagineStyle : public QProxyStyle
             QPainter *painter,
             const QWidget *widget = nullptr) const override
     {
-        switch (element) {
-        case PE_IndicatorCheckBox:
-            if (const QStyleOptionButton *buttonOption = qstyleoption_cast<const QStyleOptionButton *>(option)) {
-                const QString baseName = baseNameButton(QStringLiteral("checkbox-indicator"), buttonOption);
-                if (const auto imagineImage = resolveImage(baseName, buttonOption)) {
-                    imagineImage->draw(painter, buttonOption->rect);
-                    return;
-                }
-            }
-            break;
-        case PE_IndicatorRadioButton:
-            if (const QStyleOptionButton *buttonOption = qstyleoption_cast<const QStyleOptionButton *>(option)) {
-                const QString baseName = baseNameButton(QStringLiteral("radiobutton-indicator"), buttonOption);
-                if (const auto imagineImage = resolveImage(baseName, buttonOption)) {
-                    imagineImage->draw(painter, buttonOption->rect);
-                    return;
-                }
-            }
-            break;
-        case PE_PanelLineEdit:
-            if (const QStyleOptionFrame *frameOption = qstyleoption_cast<const QStyleOptionFrame *>(option)) {
-                if (qobject_cast<QComboBox *>(widget->parentWidget())) {
-                    // Don't draw a frame around the line edit when inside a QComboBox!
-                    return;
-                }
-                const QString baseName = baseNameTextInput(frameOption);
-                if (const auto imagineImage = resolveImage(baseName, frameOption)) {
-                    imagineImage->draw(painter, frameOption->rect);
-                    return;
-                }
-                return;
-            }
-            break;
-        default:
-            break;
-        }
+        if (drawElement(QImagineElementRule::Primitive, element, option, painter, widget))
+            return;
 
         QProxyStyle::drawPrimitive(element, option, painter, widget);
     }
@@ -213,15 +1009,6 @@ class QImagineStyle : public QProxyStyle
             const QWidget *widget = nullptr) const override
     {
         switch (element) {
-        case CE_PushButtonBevel:
-            if (const QStyleOptionButton *buttonOption = qstyleoption_cast<const QStyleOptionButton *>(option)) {
-                const QString baseName = baseNameButton(QStringLiteral("button-background"), buttonOption);
-                if (const auto imagineImage = resolveImage(baseName, buttonOption)) {
-                    imagineImage->draw(painter, buttonOption->rect);
-                    return;
-                }
-            }
-            break;
         case CE_ComboBoxLabel:
             return;
 //            if (const auto *comboOption = qstyleoption_cast<const QStyleOptionComboBox *>(option)) {
@@ -239,6 +1026,9 @@ class QImagineStyle : public QProxyStyle
             break;
         }
 
+        if (drawElement(QImagineElementRule::Control, element, option, painter, widget))
+            return;
+
         QProxyStyle::drawControl(element, option, painter, widget);
     }
 
@@ -250,55 +1040,8 @@ class QImagineStyle : public QProxyStyle
             QPainter *painter,
             const QWidget *widget) const override
     {
-        const SubControls subControls = option->subControls;
-
-        switch (element) {
-        case CC_Slider:
-            if (const auto *sliderOption = qstyleoption_cast<const QStyleOptionSlider *>(option)) {
-                const QString baseNameBackground = baseNameSliderBackground(sliderOption);
-                if (const auto imagineImage = resolveImage(baseNameBackground, sliderOption)) {
-                    imagineImage->draw(painter, sliderOption->rect);
-
-                    const QString baseNameProgress = baseNameSliderProgress(sliderOption);
-                    if (const auto imagineImage = resolveImage(baseNameProgress, sliderOption)) {
-                        QRect progressRect = proxy()->subControlRect(CC_Slider, sliderOption, SC_SliderGroove, widget);
-                        const qreal scale = sliderOption->sliderValue / qMax(0.001, qreal(sliderOption->maximum - sliderOption->minimum));
-                        progressRect.setWidth(progressRect.width() * scale);
-                        imagineImage->draw(painter, progressRect);
-                    }
-
-                    const QString baseNameHandle = baseNameSliderHandle(sliderOption);
-                    if (const auto imagineImage = resolveImage(baseNameHandle, sliderOption)) {
-                        const QRect handleRect = proxy()->subControlRect(CC_Slider, sliderOption, SC_SliderHandle, widget);
-                        imagineImage->draw(painter, handleRect);
-                    }
-                    return;
-                }
-            }
-            break;
-        case CC_ComboBox:
-            if (const auto *comboOption = qstyleoption_cast<const QStyleOptionComboBox *>(option)) {
-                if (subControls & SC_ComboBoxFrame) {
-                    const QString baseName = baseNameComboBoxBackground(comboOption);
-                    if (const auto imagineImage = resolveImage(baseName, comboOption))
-                        imagineImage->draw(painter, comboOption->rect);
-                }
-                if (subControls & SC_ComboBoxArrow) {
-                    const QString baseName = baseNameComboBoxIndicator(comboOption);
-                    if (const auto imagineImage = resolveImage(baseName, comboOption)) {
-                        const QRect arrowRect = subControlRect(CC_ComboBox, comboOption, SC_ComboBoxArrow, widget);
-                        imagineImage->draw(painter, arrowRect);
-                    }
-                }
-                if (subControls & SC_ComboBoxEditField) {
-
-                }
-                return;
-            }
-            break;
-        default:
-            break;
-        }
+        if (drawComplexElement(element, option, painter, widget))
+            return;
 
         QProxyStyle::drawComplexControl(element, option, painter, widget);
     }
@@ -311,51 +1054,34 @@ class QImagineStyle : public QProxyStyle
             const QSize &size,
             const QWidget *widget) const override
     {
-        switch (type)  {
-        case CT_PushButton: {
-            if (const auto *buttonOption = qstyleoption_cast<const QStyleOptionButton *>(option)) {
-                const QString baseName = baseNameButton(QStringLiteral("button-background"), buttonOption);
-                if (const auto imagineImage = resolveImage(baseName, buttonOption))
-                    return imagineImage->size();
-            }
-            break;
-        }
-        case CT_CheckBox: {
-            if (const auto *buttonOption = qstyleoption_cast<const QStyleOptionButton *>(option)) {
-                const QString baseName = baseNameButton(QStringLiteral("checkbox-indicator"), buttonOption);
-                if (const auto imagineImage = resolveImage(baseName, buttonOption))
-                    return imagineImage->size();
-            }
-            break;
-        }
-        case CT_RadioButton: {
-            if (const auto *buttonOption = qstyleoption_cast<const QStyleOptionButton *>(option)) {
-                const QString baseName = baseNameButton(QStringLiteral("radiobutton-indicator"), buttonOption);
-                if (const auto imagineImage = resolveImage(baseName, buttonOption))
-                    return imagineImage->size();
-            }
-            break;
-        }
-        case CT_ComboBox: {
-            if (const auto *comboOption = qstyleoption_cast<const QStyleOptionComboBox *>(option)) {
-                const QString baseName = baseNameComboBoxIndicator(comboOption);
-                if (const auto imagineImage = resolveImage(baseName, comboOption))
-                    return imagineImage->size();
-            }
-            break;
-        }
-        case CT_Slider:
-            if (const auto *sliderOption = qstyleoption_cast<const QStyleOptionSlider *>(option)) {
-                const QString baseNameHandle = baseNameSliderHandle(sliderOption);
-                if (const auto imagineImage = resolveImage(baseNameHandle, sliderOption))
-                    return QSize(100, imagineImage->size().height());
-            }
-            break;
-        default:
-            break;
-        }
+        QSize result = QProxyStyle::sizeFromContents(type, option, size, widget);
+        if (!option)
+            return result;
 
-        return QProxyStyle::sizeFromContents(type, option, size, widget);
+        // Like drawing, the first rule of an element and part that has an asset wins
+        QVarLengthArray<const QImagineElementRule *, 4> sizedParts;
+        for (const QImagineElementRule *rule : m_elements.contentsRules(type)) {
+            if (!QImagineElementMap::applies(*rule, option))
+                continue;
+            const bool sized = std::any_of(sizedParts.cbegin(), sizedParts.cend(), [rule](const QImagineElementRule *other) {
+                return other->kind == rule->kind && other->element == rule->element && other->part == rule->part;
+            });
+            if (sized)
+                continue;
+            const QImagineStyleImage *imagineImage = resolveRule(*rule, option);
+            if (!imagineImage)
+                continue;
+            sizedParts.append(rule);
+
+            const QSize assetSize = imagineImage->size();
+            if (rule->sizing == QImagineElementRule::AssetSize)
+                result = result.expandedTo(assetSize);
+            else if (QImagineElementMap::isVertical(option))
+                result.setWidth(qMax(result.width(), assetSize.width()));
+            else
+                result.setHeight(qMax(result.height(), assetSize.height()));
+        }
+        return result;
     }
 
 // -----------------------------------------------------------------------
@@ -366,27 +1092,59 @@ class QImagineStyle : public QProxyStyle
             SubControl subControl,
             const QWidget *widget) const override
     {
-        switch (element) {
-        case CC_ComboBox: {
-            switch (subControl) {
-            case SC_ComboBoxArrow:
-                if (const auto *comboOption = qstyleoption_cast<const QStyleOptionComboBox *>(option)) {
-                    const QString baseName = baseNameComboBoxIndicator(comboOption);
-                    if (const auto imagineImage = resolveImage(baseName, comboOption)) {
-                        const QRect frame = comboOption->rect;
-                        const QSize indicatorSize = imagineImage->size();
-                        return QRect(frame.width() - indicatorSize.width(), 0, indicatorSize.width(), indicatorSize.height());
-                    }
-                }
-            default:
+        const QRect baseRect = QProxyStyle::subControlRect(element, option, subControl, widget);
+
+        const QImagineElementRule *partRule = nullptr;
+        for (const QImagineElementRule *rule : m_elements.rules(QImagineElementRule::ComplexControl, element)) {
+            if ((rule->part & subControl) && QImagineElementMap::applies(*rule, option)) {
+                partRule = rule;
                 break;
             }
-            break; }
-        default:
-            break;
+        }
+        if (!partRule || partRule->alignment == QImagineElementRule::BaseAlignment)
+            return baseRect;
+
+        // The parts lie where the assets put them only when the control is drawn with assets
+        ResolvedParts parts;
+        SubControls handledParts = SC_None;
+        if (!resolveParts(element, option, SC_All, &parts, &handledParts))
+            return baseRect;
+
+        const QRect frame = option->rect;
+        int start = frame.left();
+        int end = frame.right();
+        for (const auto &part : parts) {
+            const QImagineElementRule &rule = *part.first;
+            const QSize assetSize = part.second->size();
+            QRect rect;
+            switch (rule.alignment) {
+            case QImagineElementRule::AtStart:
+            case QImagineElementRule::AtEnd: {
+                const int height = (rule.flags & QImagineElementRule::NaturalSize) ? assetSize.height() : frame.height();
+                const int x = rule.alignment == QImagineElementRule::AtStart ? frame.left() : frame.right() + 1 - assetSize.width();
+                rect = QRect(x, frame.top() + (frame.height() - height) / 2, assetSize.width(), height);
+                if (rule.alignment == QImagineElementRule::AtStart)
+                    start = qMax(start, rect.right() + 1);
+                else
+                    end = qMin(end, rect.left() - 1);
+                break; }
+            case QImagineElementRule::Centered:
+                rect = QRect(QPoint(), assetSize);
+                rect.moveCenter(baseRect.center());
+                // The base rect is already visual
+                if (&rule == partRule)
+                    return rect;
+                continue;
+            default:
+                continue;
+            }
+            if (&rule == partRule)
+                return visualRect(option->direction, frame, rect);
         }
 
-        return QProxyStyle::subControlRect(element, option, subControl, widget);
+        if (partRule->alignment == QImagineElementRule::Remainder)
+            return visualRect(option->direction, frame, QRect(QPoint(start, frame.top()), QPoint(end, frame.bottom())));
+        return baseRect;
     }
 
 // -----------------------------------------------------------------------
@@ -437,7 +1195,33 @@ class QImagineStyle : public QProxyStyle
 // -----------------------------------------------------------------------
 
 private:
-    QHash<QString, QImagineStyleImage*> m_images;
+    Options m_options;
+    QString m_imagePath;
+    LoadReport m_loadReport;
+    QImagineStretchQuality m_stretchQuality = QImagineStretchQuality::Bilinear;
+    QScopedPointer<QImagineDiskCache> m_diskCache;
+    QSet<QString> m_diskCacheSignature;
+    bool m_diskCacheSaveScheduled = false;
+    // Derived variants are added while painting
+    mutable QHash<QString, QImagineStyleImage*> m_images;
+    // Images that findImage() found no file for, keyed on name and scale suffix
+    mutable QSet<QString> m_missingImages;
+    QImagineElementMap m_elements;
+    QThreadPool m_prewarmPool;
+    // The images and sizes that were queued for pre-warming
+    QSet<QPair<const QImagineStyleImage *, quint64>> m_prewarmed;
+
+    QScopedPointer<QFileSystemWatcher> m_watcher;
+    QTimer m_reloadTimer;
+    QSet<QString> m_pendingReloads;
+    QHash<QString, QDateTime> m_fileTimes;
+    // Derived or synthesized image -> the image it was made from
+    mutable QHash<QString, QString> m_imageSources;
+    // Which live widgets drew each image, and the other way around
+    mutable QHash<const QImagineStyleImage *, QSet<QWidget *>> m_imageUsers;
+    mutable QHash<QWidget *, QVector<const QImagineStyleImage *>> m_userImages;
 };
 
+Q_DECLARE_OPERATORS_FOR_FLAGS(QImagineStyle::Options)
+
 #endif // QIMAGINESTYLE_H
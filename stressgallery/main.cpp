@@ -0,0 +1,118 @@
+#include <QApplication>
+#include <QCommandLineParser>
+#include <QDebug>
+
+#include "opaquebenchmark.h"
+#include "qimaginestyle.h"
+#include "stressgallery.h"
+#include "stretchbenchmark.h"
+
+static bool parseNames(const QString &value, const QStringList &knownNames, QStringList *names)
+{
+    names->clear();
+    if (value.isEmpty() || value == QLatin1String("none"))
+        return true;
+    const QStringList parts = value.split(QLatin1Char(','));
+    for (const QString &part : parts) {
+        const QString name = part.trimmed();
+        if (!knownNames.contains(name)) {
+            qWarning() << "unknown name:" << name << "expected one of:" << knownNames;
+            return false;
+        }
+        names->append(name);
+    }
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    QApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QStringLiteral("Paints grids of styled widgets while interacting with them, "
+                                                    "and shows how long that takes"));
+    parser.addHelpOption();
+    const QCommandLineOption rowsOption(QStringLiteral("rows"),
+            QStringLiteral("Rows in the grid."), QStringLiteral("count"), QStringLiteral("40"));
+    const QCommandLineOption columnsOption(QStringLiteral("columns"),
+            QStringLiteral("Columns in the grid."), QStringLiteral("count"), QStringLiteral("25"));
+    const QCommandLineOption controlsOption(QStringLiteral("controls"),
+            QStringLiteral("Comma separated controls to fill the grid with, out of: %1.")
+                .arg(StressGallery::controlNames().join(QStringLiteral(", "))),
+            QStringLiteral("names"), StressGallery::controlNames().join(QLatin1Char(',')));
+    const QCommandLineOption interactionsOption(QStringLiteral("interactions"),
+            QStringLiteral("Comma separated interactions to run in turn, out of: %1, or none.")
+                .arg(StressGallery::interactionNames().join(QStringLiteral(", "))),
+            QStringLiteral("names"), StressGallery::interactionNames().join(QLatin1Char(',')));
+    const QCommandLineOption phaseOption(QStringLiteral("phase-frames"),
+            QStringLiteral("Frames to spend on each interaction."), QStringLiteral("count"), QStringLiteral("180"));
+    const QCommandLineOption durationOption(QStringLiteral("duration"),
+            QStringLiteral("Seconds to run before printing a summary and quitting, 0 runs until closed."),
+            QStringLiteral("seconds"), QStringLiteral("0"));
+    const QCommandLineOption imagesOption(QStringLiteral("images"),
+            QStringLiteral("Directory with the style assets."), QStringLiteral("path"), QStringLiteral(":/images"));
+    const QCommandLineOption deriveOption(QStringLiteral("derive-variants"),
+            QStringLiteral("Derive the variants that can be derived, instead of loading them."));
+    const QCommandLineOption cacheOption(QStringLiteral("persistent-cache"),
+            QStringLiteral("Keep decoded assets and renders on disk between runs."));
+    const QCommandLineOption watchOption(QStringLiteral("watch"),
+            QStringLiteral("Reload assets that change in the image directory."));
+    const QCommandLineOption nearestOption(QStringLiteral("nearest"),
+            QStringLiteral("Stretch nine-patch images with nearest neighbor sampling."));
+    const QCommandLineOption stretchOption(QStringLiteral("stretch-benchmark"),
+            QStringLiteral("Check the stretch kernel paths against each other, time them against "
+                           "QImage::scaled() with the given iterations, and quit."),
+            QStringLiteral("iterations"));
+    const QCommandLineOption opaqueOption(QStringLiteral("opaque-benchmark"),
+            QStringLiteral("Time drawing nine-patch renders with their opaque interiors blended and copied, "
+                           "with the given iterations, print where copying starts to pay off, and quit."),
+            QStringLiteral("iterations"));
+    parser.addOptions({ rowsOption, columnsOption, controlsOption, interactionsOption, phaseOption,
+                        durationOption, imagesOption, deriveOption, cacheOption, watchOption, nearestOption,
+                        stretchOption, opaqueOption });
+    parser.process(app);
+
+    if (parser.isSet(stretchOption))
+        return runStretchBenchmark(qMax(1, parser.value(stretchOption).toInt())) ? 0 : 1;
+    if (parser.isSet(opaqueOption)) {
+        runOpaqueBenchmark(qMax(1, parser.value(opaqueOption).toInt()));
+        return 0;
+    }
+
+    StressGalleryConfig config;
+    config.rows = qMax(1, parser.value(rowsOption).toInt());
+    config.columns = qMax(1, parser.value(columnsOption).toInt());
+    config.phaseFrames = qMax(1, parser.value(phaseOption).toInt());
+    config.duration = qMax(0, parser.value(durationOption).toInt());
+    if (!parseNames(parser.value(controlsOption), StressGallery::controlNames(), &config.controls)
+            || !parseNames(parser.value(interactionsOption), StressGallery::interactionNames(), &config.interactions)) {
+        return 1;
+    }
+
+    QImagineStyle::Options options;
+    if (parser.isSet(deriveOption))
+        options |= QImagineStyle::DeriveVariants;
+    if (parser.isSet(cacheOption))
+        options |= QImagineStyle::PersistentCache;
+    if (parser.isSet(watchOption))
+        options |= QImagineStyle::WatchImagePath;
+
+    // The timing style takes ownership of the imagine style
+    auto *imagineStyle = new QImagineStyle(parser.value(imagesOption), options);
+    if (parser.isSet(nearestOption))
+        imagineStyle->setStretchQuality(QImagineStretchQuality::Nearest);
+    auto *timingStyle = new StressTimingStyle(imagineStyle);
+    app.setStyle(timingStyle);
+
+    StressGallery gallery(config, imagineStyle, timingStyle);
+    gallery.show();
+
+    if (config.duration > 0) {
+        QTimer::singleShot(config.duration * 1000, &gallery, [&gallery] {
+            gallery.printSummary();
+            QApplication::quit();
+        });
+    }
+
+    return app.exec();
+}
@@ -0,0 +1,85 @@
+#include "opaquebenchmark.h"
+#include "ninepatch.h"
+
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QImage>
+#include <QPainter>
+
+namespace {
+
+// Sizes of controls, from small indicators to large panels
+const QSize drawSizes[] = {
+    QSize(16, 16),
+    QSize(24, 24),
+    QSize(40, 24),
+    QSize(64, 32),
+    QSize(100, 30),
+    QSize(200, 40),
+    QSize(300, 200),
+    QSize(800, 600),
+};
+
+QImage backgroundAsset()
+{
+    // A 24x24 background with a translucent 4 pixel border around an opaque interior, and
+    // markers that stretch and fit the contents to the middle 8 pixels
+    QImage image(26, 26, QImage::Format_ARGB32_Premultiplied);
+    image.fill(Qt::transparent);
+    QPainter painter(&image);
+    painter.fillRect(QRect(1, 1, 24, 24), QColor(60, 70, 80, 128));
+    painter.fillRect(QRect(5, 5, 16, 16), QColor(170, 178, 189));
+    painter.end();
+    for (int i = 9; i < 17; ++i) {
+        image.setPixel(i, 0, qRgb(0, 0, 0));
+        image.setPixel(0, i, qRgb(0, 0, 0));
+        image.setPixel(i, 25, qRgb(0, 0, 0));
+        image.setPixel(25, i, qRgb(0, 0, 0));
+    }
+    return image;
+}
+
+qint64 nanosecondsPerDraw(const QStyleNinePatchImage &asset, const QSize &size, int iterations)
+{
+    QImage target(size, QImage::Format_ARGB32_Premultiplied);
+    target.fill(Qt::white);
+    QPainter painter(&target);
+    const QRect rect(QPoint(), size);
+
+    // Once untimed, so that the render is made and cached
+    asset.draw(&painter, rect);
+    QElapsedTimer timer;
+    timer.start();
+    for (int i = 0; i < iterations; ++i)
+        asset.draw(&painter, rect);
+    return timer.nsecsElapsed() / iterations;
+}
+
+} // namespace
+
+void runOpaqueBenchmark(int iterations)
+{
+    QStyleNinePatchImage asset(backgroundAsset());
+    int crossover = -1;
+    for (const QSize &size : drawSizes) {
+        asset.setOpaqueBlitArea(-1);
+        const qint64 blended = nanosecondsPerDraw(asset, size, iterations);
+        asset.setOpaqueBlitArea(0);
+        const qint64 copied = nanosecondsPerDraw(asset, size, iterations);
+
+        // The interior is the asset's opaque 16x16, stretched by the 8 middle pixels
+        const int opaqueArea = (size.width() - 8) * (size.height() - 8);
+        if (copied < blended && crossover < 0)
+            crossover = opaqueArea;
+        else if (copied >= blended)
+            crossover = -1;
+
+        qDebug().noquote().nospace() << "opaque: " << size.width() << "x" << size.height() << " (" << opaqueArea
+                                     << " opaque px): blended " << blended << " ns, copied " << copied << " ns";
+    }
+
+    if (crossover < 0)
+        qDebug() << "opaque: copying the interior was not faster at any size";
+    else
+        qDebug() << "opaque: copying the interior is faster from" << crossover << "opaque pixels";
+}
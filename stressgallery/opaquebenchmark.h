@@ -0,0 +1,9 @@
+#ifndef OPAQUEBENCHMARK_H
+#define OPAQUEBENCHMARK_H
+
+// Times drawing nine-patch renders of growing sizes into a raster image, with the opaque interior
+// blended and with it copied, and prints the smallest opaque area where copying is faster. That
+// is the area to set with QStyleNinePatchImage::setOpaqueBlitArea() on the machine it ran on.
+void runOpaqueBenchmark(int iterations);
+
+#endif // OPAQUEBENCHMARK_H
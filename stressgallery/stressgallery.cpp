@@ -0,0 +1,561 @@
+#include "stressgallery.h"
+#include "qimaginestyle.h"
+
+#include <QCheckBox>
+#include <QComboBox>
+#include <QDebug>
+#include <QEvent>
+#include <QGridLayout>
+#include <QGroupBox>
+#include <QLineEdit>
+#include <QPainter>
+#include <QProgressBar>
+#include <QPushButton>
+#include <QRadioButton>
+#include <QScrollArea>
+#include <QScrollBar>
+#include <QSlider>
+#include <QSpinBox>
+#include <QTabBar>
+#include <QToolButton>
+#include <QVBoxLayout>
+#include <QtMath>
+
+namespace {
+
+struct StressControl {
+    const char *name;
+    QWidget *(*create)(int index);
+};
+
+// One entry per control that the style draws
+const StressControl stressControls[] = {
+    { "button", [](int index) -> QWidget * {
+        auto *button = new QPushButton(QStringLiteral("Button %1").arg(index));
+        // Leave some of them checkable, so that toggling has checked variants to draw
+        button->setCheckable(index % 3 == 0);
+        return button;
+    } },
+    { "checkbox", [](int index) -> QWidget * {
+        return new QCheckBox(QStringLiteral("Check %1").arg(index));
+    } },
+    { "radiobutton", [](int index) -> QWidget * {
+        auto *radioButton = new QRadioButton(QStringLiteral("Radio %1").arg(index));
+        // All of them share a parent, which would leave a single one checked
+        radioButton->setAutoExclusive(false);
+        return radioButton;
+    } },
+    { "lineedit", [](int index) -> QWidget * {
+        return new QLineEdit(QStringLiteral("Text %1").arg(index));
+    } },
+    { "combobox", [](int index) -> QWidget * {
+        auto *comboBox = new QComboBox;
+        comboBox->addItems({ QStringLiteral("Item %1").arg(index), QStringLiteral("Other") });
+        return comboBox;
+    } },
+    { "editablecombobox", [](int index) -> QWidget * {
+        auto *comboBox = new QComboBox;
+        comboBox->setEditable(true);
+        comboBox->addItems({ QStringLiteral("Item %1").arg(index), QStringLiteral("Other") });
+        return comboBox;
+    } },
+    { "slider", [](int index) -> QWidget * {
+        auto *slider = new QSlider(Qt::Horizontal);
+        slider->setRange(0, 100);
+        slider->setValue(index % 101);
+        return slider;
+    } },
+    { "spinbox", [](int index) -> QWidget * {
+        auto *spinBox = new QSpinBox;
+        spinBox->setRange(0, 100);
+        spinBox->setValue(index % 101);
+        return spinBox;
+    } },
+    { "toolbutton", [](int index) -> QWidget * {
+        auto *toolButton = new QToolButton;
+        toolButton->setText(QStringLiteral("Tool %1").arg(index));
+        toolButton->setCheckable(index % 3 == 0);
+        return toolButton;
+    } },
+    { "tabbar", [](int index) -> QWidget * {
+        auto *tabBar = new QTabBar;
+        tabBar->addTab(QStringLiteral("Tab %1").arg(index));
+        tabBar->addTab(QStringLiteral("Other"));
+        return tabBar;
+    } },
+    { "groupbox", [](int index) -> QWidget * {
+        auto *groupBox = new QGroupBox(QStringLiteral("Group %1").arg(index));
+        auto *layout = new QVBoxLayout(groupBox);
+        layout->addWidget(new QCheckBox(QStringLiteral("Check")));
+        return groupBox;
+    } },
+    { "progressbar", [](int index) -> QWidget * {
+        auto *progressBar = new QProgressBar;
+        progressBar->setRange(0, 100);
+        progressBar->setValue(index % 101);
+        return progressBar;
+    } },
+    { "itemgrid", [](int index) -> QWidget * {
+        return new StressItemGrid(index);
+    } },
+    { "scrollbar", [](int index) -> QWidget * {
+        auto *scrollBar = new QScrollBar(Qt::Horizontal);
+        scrollBar->setRange(0, 100);
+        scrollBar->setValue(index % 101);
+        return scrollBar;
+    } },
+};
+
+const char *const stressInteractions[] = { "resize", "slider", "focus", "toggle" };
+
+} // namespace
+
+// -----------------------------------------------------------------------
+
+StressTimingStyle::StressTimingStyle(QStyle *style)
+    : QProxyStyle(style)
+{
+}
+
+void StressTimingStyle::drawPrimitive(PrimitiveElement element, const QStyleOption *option,
+                                      QPainter *painter, const QWidget *widget) const
+{
+    begin();
+    QProxyStyle::drawPrimitive(element, option, painter, widget);
+    end();
+}
+
+void StressTimingStyle::drawControl(ControlElement element, const QStyleOption *option,
+                                    QPainter *painter, const QWidget *widget) const
+{
+    begin();
+    QProxyStyle::drawControl(element, option, painter, widget);
+    end();
+}
+
+void StressTimingStyle::drawComplexControl(ComplexControl control, const QStyleOptionComplex *option,
+                                           QPainter *painter, const QWidget *widget) const
+{
+    begin();
+    QProxyStyle::drawComplexControl(control, option, painter, widget);
+    end();
+}
+
+bool StressTimingStyle::drawPrimitiveBatch(PrimitiveElement element, const QStyleOption *option, const QVector<QRect> &rects,
+                                           QPainter *painter, const QWidget *widget) const
+{
+    const auto *imagineStyle = dynamic_cast<const QImagineStyle *>(baseStyle());
+    if (!imagineStyle)
+        return false;
+    begin();
+    const bool drawn = imagineStyle->drawPrimitiveBatch(element, option, rects, painter, widget);
+    end();
+    return drawn;
+}
+
+qint64 StressTimingStyle::takeNanoseconds()
+{
+    const qint64 nanoseconds = m_nanoseconds;
+    m_nanoseconds = 0;
+    return nanoseconds;
+}
+
+void StressTimingStyle::begin() const
+{
+    if (m_depth++ == 0)
+        m_timer.start();
+}
+
+void StressTimingStyle::end() const
+{
+    if (--m_depth == 0)
+        m_nanoseconds += m_timer.nsecsElapsed();
+}
+
+// -----------------------------------------------------------------------
+
+StressOverlay::StressOverlay(QWidget *parent)
+    : QWidget(parent)
+{
+    setAttribute(Qt::WA_TransparentForMouseEvents);
+}
+
+void StressOverlay::setLines(const QStringList &lines)
+{
+    m_lines = lines;
+    resize(sizeHint());
+    update();
+}
+
+QSize StressOverlay::sizeHint() const
+{
+    static const int margin = 8;
+    int width = 0;
+    for (const QString &line : m_lines)
+        width = qMax(width, fontMetrics().horizontalAdvance(line));
+    return QSize(width, fontMetrics().lineSpacing() * m_lines.size()) + QSize(margin, margin) * 2;
+}
+
+void StressOverlay::paintEvent(QPaintEvent *)
+{
+    static const int margin = 8;
+    QPainter painter(this);
+    painter.fillRect(rect(), QColor(0, 0, 0, 180));
+    painter.setPen(Qt::white);
+    int y = margin + fontMetrics().ascent();
+    for (const QString &line : qAsConst(m_lines)) {
+        painter.drawText(margin, y, line);
+        y += fontMetrics().lineSpacing();
+    }
+}
+
+// -----------------------------------------------------------------------
+
+static const int itemGridColumns = 3;
+static const int itemGridRows = 4;
+
+StressItemGrid::StressItemGrid(int index)
+    : m_checkStates(itemGridColumns * itemGridRows, Qt::Unchecked)
+    , m_selectedItem(index % (itemGridColumns * itemGridRows))
+{
+    for (int item = 0; item < m_checkStates.size(); ++item)
+        m_checkStates[item] = Qt::CheckState((index + item) % 3);
+}
+
+void StressItemGrid::toggle(int frame)
+{
+    m_selectedItem = frame % m_checkStates.size();
+    Qt::CheckState &checkState = m_checkStates[(frame * 5) % m_checkStates.size()];
+    checkState = Qt::CheckState((checkState + 1) % 3);
+    update();
+}
+
+QSize StressItemGrid::itemSize() const
+{
+    const int indicatorWidth = style()->pixelMetric(QStyle::PM_IndicatorWidth, nullptr, this);
+    const int indicatorHeight = style()->pixelMetric(QStyle::PM_IndicatorHeight, nullptr, this);
+    return QSize(indicatorWidth + fontMetrics().horizontalAdvance(QStringLiteral("Item 00")) + 12,
+                 qMax(indicatorHeight, fontMetrics().height()) + 4);
+}
+
+QRect StressItemGrid::itemRect(int item) const
+{
+    const QSize size = itemSize();
+    return QRect(QPoint(item % itemGridColumns * size.width(), item / itemGridColumns * size.height()), size);
+}
+
+QSize StressItemGrid::sizeHint() const
+{
+    return QSize(itemGridColumns * itemSize().width(), itemGridRows * itemSize().height());
+}
+
+void StressItemGrid::paintEvent(QPaintEvent *)
+{
+    QPainter painter(this);
+    QStyleOptionViewItem option;
+    option.initFrom(this);
+    option.features = QStyleOptionViewItem::HasCheckIndicator;
+    const int indicatorWidth = style()->pixelMetric(QStyle::PM_IndicatorWidth, &option, this);
+    const int indicatorHeight = style()->pixelMetric(QStyle::PM_IndicatorHeight, &option, this);
+
+    // Sorted by the look that the style gives them, which is what a batch shares
+    QVector<QRect> backgrounds[2];
+    QVector<QRect> indicators[3];
+    for (int item = 0; item < m_checkStates.size(); ++item) {
+        const QRect rect = itemRect(item);
+        backgrounds[item == m_selectedItem].append(rect);
+        const QRect indicator(0, 0, indicatorWidth, indicatorHeight);
+        indicators[m_checkStates[item]].append(indicator.translated(rect.left() + 2, rect.center().y() - indicatorHeight / 2));
+    }
+
+    for (int selected = 0; selected < 2; ++selected) {
+        QStyleOptionViewItem backgroundOption(option);
+        if (selected)
+            backgroundOption.state |= QStyle::State_Selected;
+        drawBatch(&painter, QStyle::PE_PanelItemViewItem, &backgroundOption, backgrounds[selected]);
+    }
+
+    static const QStyle::State checkStates[] = { QStyle::State_Off, QStyle::State_NoChange, QStyle::State_On };
+    for (int checkState = 0; checkState < 3; ++checkState) {
+        QStyleOptionViewItem indicatorOption(option);
+        indicatorOption.state |= checkStates[checkState];
+        indicatorOption.checkState = Qt::CheckState(checkState);
+        drawBatch(&painter, QStyle::PE_IndicatorItemViewItemCheck, &indicatorOption, indicators[checkState]);
+    }
+
+    painter.setPen(palette().color(QPalette::Text));
+    for (int item = 0; item < m_checkStates.size(); ++item) {
+        const QRect rect = itemRect(item).adjusted(indicatorWidth + 6, 0, 0, 0);
+        painter.drawText(rect, Qt::AlignVCenter, QStringLiteral("Item %1").arg(item));
+    }
+}
+
+void StressItemGrid::drawBatch(QPainter *painter, QStyle::PrimitiveElement element, QStyleOptionViewItem *option,
+                               const QVector<QRect> &rects) const
+{
+    if (rects.isEmpty())
+        return;
+    const auto *timingStyle = dynamic_cast<const StressTimingStyle *>(style());
+    if (timingStyle && timingStyle->drawPrimitiveBatch(element, option, rects, painter, this))
+        return;
+
+    for (const QRect &rect : rects) {
+        option->rect = rect;
+        style()->drawPrimitive(element, option, painter, this);
+    }
+}
+
+// -----------------------------------------------------------------------
+
+StressGallery::StressGallery(const StressGalleryConfig &config, QImagineStyle *imagineStyle, StressTimingStyle *timingStyle)
+    : m_config(config)
+    , m_imagineStyle(imagineStyle)
+    , m_timingStyle(timingStyle)
+{
+    QStringList controls = m_config.controls;
+    if (controls.isEmpty())
+        controls = controlNames();
+
+    auto *grid = new QWidget;
+    auto *gridLayout = new QGridLayout(grid);
+    for (int row = 0; row < m_config.rows; ++row) {
+        for (int column = 0; column < m_config.columns; ++column) {
+            const int index = row * m_config.columns + column;
+            const QString &name = controls.at(index % controls.size());
+            for (const StressControl &control : stressControls) {
+                if (name == QLatin1String(control.name)) {
+                    QWidget *widget = control.create(index);
+                    gridLayout->addWidget(widget, row, column);
+                    m_controls.append(widget);
+                    break;
+                }
+            }
+        }
+    }
+
+    m_scrollArea = new QScrollArea;
+    m_scrollArea->setWidget(grid);
+    m_scrollArea->setWidgetResizable(true);
+    auto *layout = new QGridLayout(this);
+    layout->setContentsMargins(0, 0, 0, 0);
+    layout->addWidget(m_scrollArea);
+
+    // Created last, so that it stays on top of the grid
+    m_overlay = new StressOverlay(this);
+
+    setWindowTitle(QStringLiteral("Stress gallery: %1 widgets").arg(m_controls.size()));
+    resize(1280, 800);
+
+    // Aim for one interaction step per frame at 60 Hz
+    static const int stepInterval = 16;
+    m_stepTimer.setTimerType(Qt::PreciseTimer);
+    m_stepTimer.setInterval(stepInterval);
+    connect(&m_stepTimer, &QTimer::timeout, this, [this] { step(); });
+    if (!m_config.interactions.isEmpty() && !m_controls.isEmpty())
+        m_stepTimer.start();
+
+    static const int overlayInterval = 500;
+    m_overlayTimer.setInterval(overlayInterval);
+    connect(&m_overlayTimer, &QTimer::timeout, this, [this] { updateOverlay(); });
+    m_overlayTimer.start();
+    m_periodTimer.start();
+    updateOverlay();
+}
+
+QStringList StressGallery::controlNames()
+{
+    QStringList names;
+    for (const StressControl &control : stressControls)
+        names.append(QLatin1String(control.name));
+    return names;
+}
+
+QStringList StressGallery::interactionNames()
+{
+    QStringList names;
+    for (const char *interaction : stressInteractions)
+        names.append(QLatin1String(interaction));
+    return names;
+}
+
+bool StressGallery::event(QEvent *event)
+{
+    if (event->type() != QEvent::UpdateRequest)
+        return QWidget::event(event);
+
+    // Everything that is painted for a frame, and flushing it to the screen,
+    // happens while the window handles the update request
+    m_timingStyle->takeNanoseconds();
+    QElapsedTimer timer;
+    timer.start();
+    const bool result = QWidget::event(event);
+    const qint64 frame = timer.nsecsElapsed();
+    const qint64 style = m_timingStyle->takeNanoseconds();
+
+    m_periodFrames++;
+    m_periodFrameNanoseconds += frame;
+    m_periodWorstFrame = qMax(m_periodWorstFrame, frame);
+    m_periodStyleNanoseconds += style;
+    m_totalFrames++;
+    m_totalFrameNanoseconds += frame;
+    m_totalWorstFrame = qMax(m_totalWorstFrame, frame);
+    m_totalStyleNanoseconds += style;
+    return result;
+}
+
+void StressGallery::resizeEvent(QResizeEvent *event)
+{
+    QWidget::resizeEvent(event);
+    m_overlay->move(width() - m_overlay->width() - 20, 4);
+}
+
+// -----------------------------------------------------------------------
+
+void StressGallery::step()
+{
+    const int phase = m_frame / m_config.phaseFrames;
+    const int frame = m_frame % m_config.phaseFrames;
+    const QString &interaction = m_config.interactions.at(phase % m_config.interactions.size());
+    m_frame++;
+
+    if (frame == 0)
+        beginPhase(interaction);
+
+    if (interaction == QLatin1String("resize"))
+        resizeStep(frame);
+    else if (interaction == QLatin1String("slider"))
+        sliderStep(frame);
+    else if (interaction == QLatin1String("focus"))
+        focusStep();
+    else if (interaction == QLatin1String("toggle"))
+        toggleStep(frame);
+
+    if (frame == m_config.phaseFrames - 1)
+        endPhase(interaction);
+}
+
+void StressGallery::beginPhase(const QString &interaction)
+{
+    if (interaction == QLatin1String("resize")) {
+        m_baseSize = size();
+    } else if (interaction == QLatin1String("slider")) {
+        // Pressed sliders draw like they would while the user drags them
+        for (QWidget *control : qAsConst(m_controls)) {
+            if (auto *slider = qobject_cast<QAbstractSlider *>(control))
+                slider->setSliderDown(true);
+        }
+    }
+}
+
+void StressGallery::endPhase(const QString &interaction)
+{
+    if (interaction == QLatin1String("resize")) {
+        resize(m_baseSize);
+    } else if (interaction == QLatin1String("slider")) {
+        for (QWidget *control : qAsConst(m_controls)) {
+            if (auto *slider = qobject_cast<QAbstractSlider *>(control))
+                slider->setSliderDown(false);
+        }
+    } else if (interaction == QLatin1String("toggle")) {
+        for (QWidget *control : qAsConst(m_controls))
+            control->setEnabled(true);
+    }
+}
+
+void StressGallery::resizeStep(int frame)
+{
+    // One wave per phase, so that every control gets new sizes to render
+    const qreal angle = 2 * M_PI * frame / m_config.phaseFrames;
+    resize(m_baseSize + QSize(qRound(200 * qSin(angle)), qRound(120 * qSin(2 * angle))));
+}
+
+void StressGallery::sliderStep(int frame)
+{
+    // From the minimum to the maximum and back again, over the phase
+    const int value = 100 - qAbs(frame * 200 / m_config.phaseFrames - 100);
+    for (QWidget *control : qAsConst(m_controls)) {
+        if (auto *slider = qobject_cast<QAbstractSlider *>(control))
+            slider->setSliderPosition(value);
+        else if (auto *progressBar = qobject_cast<QProgressBar *>(control))
+            progressBar->setValue(value);
+    }
+}
+
+void StressGallery::focusStep()
+{
+    QWidget *control = m_controls.at(m_focusIndex++ % m_controls.size());
+    control->setFocus(Qt::TabFocusReason);
+    m_scrollArea->ensureWidgetVisible(control);
+}
+
+void StressGallery::toggleStep(int frame)
+{
+    // A different stripe of the grid every frame
+    static const int stripes = 8;
+    for (int i = frame % stripes; i < m_controls.size(); i += stripes) {
+        QWidget *control = m_controls.at(i);
+        auto *button = qobject_cast<QAbstractButton *>(control);
+        if (button && button->isCheckable())
+            button->toggle();
+        else if (auto *itemGrid = dynamic_cast<StressItemGrid *>(control))
+            itemGrid->toggle(frame);
+        else
+            control->setEnabled(!control->isEnabled());
+    }
+}
+
+// -----------------------------------------------------------------------
+
+static QString milliseconds(qint64 nanoseconds)
+{
+    return QString::number(nanoseconds / 1000000.0, 'f', 2);
+}
+
+void StressGallery::updateOverlay()
+{
+    const int frames = qMax(1, m_periodFrames);
+    const qreal fps = m_periodFrames * 1000.0 / qMax<qint64>(1, m_periodTimer.restart());
+    const QImagineStyle::CacheStats cache = m_imagineStyle->cacheStats();
+    const qint64 lookups = cache.renders.hits + cache.renders.misses;
+
+    QString interaction = QStringLiteral("none");
+    if (m_stepTimer.isActive()) {
+        const int phase = qMax(0, m_frame - 1) / m_config.phaseFrames;
+        interaction = m_config.interactions.at(phase % m_config.interactions.size());
+    }
+
+    m_overlay->setLines({
+        QStringLiteral("%1 widgets, %2 fps, interaction: %3").arg(m_controls.size()).arg(fps, 0, 'f', 1).arg(interaction),
+        QStringLiteral("frame: %1 ms avg, %2 ms worst")
+                .arg(milliseconds(m_periodFrameNanoseconds / frames), milliseconds(m_periodWorstFrame)),
+        QStringLiteral("style paint: %1 ms per frame (%2%)")
+                .arg(milliseconds(m_periodStyleNanoseconds / frames))
+                .arg(m_periodStyleNanoseconds * 100 / qMax<qint64>(1, m_periodFrameNanoseconds)),
+        QStringLiteral("images: %1, renders: %2 (%3 KiB)")
+                .arg(cache.imageCount).arg(cache.renders.renderCount).arg(cache.renders.renderBytes / 1024),
+        QStringLiteral("render cache: %1% hits, %2 misses")
+                .arg(cache.renders.hits * 100 / qMax<qint64>(1, lookups)).arg(cache.renders.misses),
+    });
+    m_overlay->move(width() - m_overlay->width() - 20, 4);
+    m_overlay->raise();
+
+    m_periodFrames = 0;
+    m_periodFrameNanoseconds = 0;
+    m_periodWorstFrame = 0;
+    m_periodStyleNanoseconds = 0;
+}
+
+void StressGallery::printSummary() const
+{
+    const int frames = qMax(1, m_totalFrames);
+    const QImagineStyle::CacheStats cache = m_imagineStyle->cacheStats();
+    const QImagineStyle::LoadReport load = m_imagineStyle->loadReport();
+    qDebug() << "stress:" << load.imageCount << "images loaded," << load.decodedBytes / 1024 << "KiB decoded,"
+             << load.derivedCount << "derived on demand," << load.cachedCount << "from the disk cache";
+    qDebug() << "stress:" << m_controls.size() << "widgets," << m_totalFrames << "frames";
+    qDebug().noquote() << "stress: frame" << milliseconds(m_totalFrameNanoseconds / frames) << "ms avg,"
+                       << milliseconds(m_totalWorstFrame) << "ms worst";
+    qDebug().noquote() << "stress: style paint" << milliseconds(m_totalStyleNanoseconds / frames) << "ms per frame";
+    qDebug() << "stress:" << cache.imageCount << "images," << cache.renders.renderCount << "renders,"
+             << cache.renders.hits << "hits," << cache.renders.misses << "misses";
+}
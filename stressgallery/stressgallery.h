@@ -0,0 +1,148 @@
+#ifndef STRESSGALLERY_H
+#define STRESSGALLERY_H
+
+#include <QElapsedTimer>
+#include <QProxyStyle>
+#include <QStringList>
+#include <QStyleOption>
+#include <QTimer>
+#include <QWidget>
+
+class QImagineStyle;
+class QScrollArea;
+
+// Measures the time spent in the draw functions of the style it wraps. Nested calls,
+// like a complex control that draws a primitive, are only counted once.
+class StressTimingStyle : public QProxyStyle
+{
+public:
+    explicit StressTimingStyle(QStyle *style);
+
+    void drawPrimitive(PrimitiveElement element, const QStyleOption *option,
+                       QPainter *painter, const QWidget *widget = nullptr) const override;
+    void drawControl(ControlElement element, const QStyleOption *option,
+                     QPainter *painter, const QWidget *widget = nullptr) const override;
+    void drawComplexControl(ComplexControl control, const QStyleOptionComplex *option,
+                            QPainter *painter, const QWidget *widget = nullptr) const override;
+
+    // Forwards to QImagineStyle::drawPrimitiveBatch() when the wrapped style is one, and returns
+    // false otherwise, so that the caller draws the rects one by one
+    bool drawPrimitiveBatch(PrimitiveElement element, const QStyleOption *option, const QVector<QRect> &rects,
+                            QPainter *painter, const QWidget *widget = nullptr) const;
+
+    // Returns the time spent drawing since the last call, and starts over
+    qint64 takeNanoseconds();
+
+private:
+    void begin() const;
+    void end() const;
+
+    mutable int m_depth = 0;
+    mutable qint64 m_nanoseconds = 0;
+    mutable QElapsedTimer m_timer;
+};
+
+// Paints a grid of checkable items like an item view does, but hands the style the backgrounds
+// and indicators of each state in one batch, instead of calling it once per item
+class StressItemGrid : public QWidget
+{
+public:
+    explicit StressItemGrid(int index);
+
+    // Moves the selection and changes the check state of an item
+    void toggle(int frame);
+    QSize sizeHint() const override;
+
+protected:
+    void paintEvent(QPaintEvent *event) override;
+
+private:
+    QSize itemSize() const;
+    QRect itemRect(int item) const;
+    void drawBatch(QPainter *painter, QStyle::PrimitiveElement element, QStyleOptionViewItem *option,
+                   const QVector<QRect> &rects) const;
+
+    QVector<Qt::CheckState> m_checkStates;
+    int m_selectedItem = 0;
+};
+
+struct StressGalleryConfig {
+    int rows = 40;
+    int columns = 25;
+    // Names from StressGallery::controlNames(), all of them when empty
+    QStringList controls;
+    // Names from StressGallery::interactionNames(), run one after the other
+    QStringList interactions;
+    int phaseFrames = 180;
+    // Seconds to run before printing a summary and quitting, or 0 to run until closed
+    int duration = 0;
+};
+
+class StressOverlay : public QWidget
+{
+public:
+    explicit StressOverlay(QWidget *parent);
+
+    void setLines(const QStringList &lines);
+    QSize sizeHint() const override;
+
+protected:
+    void paintEvent(QPaintEvent *event) override;
+
+private:
+    QStringList m_lines;
+};
+
+class StressGallery : public QWidget
+{
+public:
+    StressGallery(const StressGalleryConfig &config, QImagineStyle *imagineStyle, StressTimingStyle *timingStyle);
+
+    static QStringList controlNames();
+    static QStringList interactionNames();
+
+    void printSummary() const;
+
+protected:
+    bool event(QEvent *event) override;
+    void resizeEvent(QResizeEvent *event) override;
+
+private:
+    void step();
+    void beginPhase(const QString &interaction);
+    void endPhase(const QString &interaction);
+    void resizeStep(int frame);
+    void sliderStep(int frame);
+    void focusStep();
+    void toggleStep(int frame);
+    void updateOverlay();
+
+    StressGalleryConfig m_config;
+    QImagineStyle *m_imagineStyle;
+    StressTimingStyle *m_timingStyle;
+
+    QScrollArea *m_scrollArea;
+    StressOverlay *m_overlay;
+    QWidgetList m_controls;
+
+    QTimer m_stepTimer;
+    QTimer m_overlayTimer;
+    int m_frame = 0;
+    int m_focusIndex = 0;
+    QSize m_baseSize;
+
+    // Since the overlay was last updated
+    QElapsedTimer m_periodTimer;
+    int m_periodFrames = 0;
+    qint64 m_periodFrameNanoseconds = 0;
+    qint64 m_periodWorstFrame = 0;
+    qint64 m_periodStyleNanoseconds = 0;
+
+    // Since the start
+    int m_totalFrames = 0;
+    qint64 m_totalFrameNanoseconds = 0;
+    qint64 m_totalWorstFrame = 0;
+    qint64 m_totalStyleNanoseconds = 0;
+};
+
+#endif // STRESSGALLERY_H
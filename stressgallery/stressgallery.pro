@@ -0,0 +1,16 @@
+QT += core gui widgets
+
+CONFIG += c++11
+
+include(../imaginestyle.pri)
+
+SOURCES += \
+    main.cpp \
+    opaquebenchmark.cpp \
+    stressgallery.cpp \
+    stretchbenchmark.cpp
+
+HEADERS += \
+    opaquebenchmark.h \
+    stressgallery.h \
+    stretchbenchmark.h
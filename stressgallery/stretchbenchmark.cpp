@@ -0,0 +1,170 @@
+#include "stretchbenchmark.h"
+#include "stretchkernel.h"
+
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QImage>
+#include <QPainter>
+#include <QRandomGenerator>
+#include <cstring>
+
+namespace {
+
+const struct {
+    const char *name;
+    QImagineStretchPath path;
+} stretchPaths[] = {
+    { "scalar", QImagineStretchPath::Scalar },
+    { "sse2", QImagineStretchPath::Sse2 },
+    { "avx2", QImagineStretchPath::Avx2 },
+};
+
+// Typical nine-patch segments: the edges and the middle of a background, stretched to the
+// sizes of controls, and one large stretch
+const struct {
+    QSize source;
+    QSize target;
+} stretchCases[] = {
+    { QSize(1, 40), QSize(300, 40) },
+    { QSize(40, 1), QSize(40, 200) },
+    { QSize(8, 8), QSize(200, 60) },
+    { QSize(24, 24), QSize(512, 512) },
+};
+
+QImage randomImage(const QSize &size, QRandomGenerator *random)
+{
+    // Any premultiplied pixel: no channel above the alpha
+    QImage image(size, QImage::Format_ARGB32_Premultiplied);
+    for (int y = 0; y < image.height(); ++y) {
+        quint32 *line = reinterpret_cast<quint32 *>(image.scanLine(y));
+        for (int x = 0; x < image.width(); ++x) {
+            const quint32 alpha = random->bounded(256);
+            const auto channel = [&] { return random->bounded(alpha + 1); };
+            line[x] = (alpha << 24) | (channel() << 16) | (channel() << 8) | channel();
+        }
+    }
+    return image;
+}
+
+void stretch(const QImage &source, const QRect &sourceRect, QImage *target, const QRect &targetRect,
+             QImagineStretchQuality quality, QImagineStretchPath path)
+{
+    qImagineStretchWithPath(source.constScanLine(sourceRect.y()) + sourceRect.x() * 4, source.bytesPerLine(),
+                            sourceRect.width(), sourceRect.height(),
+                            target->scanLine(targetRect.y()) + targetRect.x() * 4, target->bytesPerLine(),
+                            targetRect.width(), targetRect.height(), quality, path);
+}
+
+bool sameArea(const QImage &a, const QImage &b, const QRect &rect)
+{
+    for (int y = rect.top(); y <= rect.bottom(); ++y) {
+        if (memcmp(a.constScanLine(y) + rect.x() * 4, b.constScanLine(y) + rect.x() * 4, size_t(rect.width()) * 4))
+            return false;
+    }
+    return true;
+}
+
+bool comparePaths(QRandomGenerator *random)
+{
+    // Random sizes, placed at an offset inside larger images, so that strides and clipping to
+    // the segment are exercised as well
+    static const int rounds = 2000;
+    bool same = true;
+    for (const auto quality : { QImagineStretchQuality::Nearest, QImagineStretchQuality::Bilinear }) {
+        int mismatches[3] = { 0, 0, 0 };
+        for (int round = 0; round < rounds; ++round) {
+            const QRect sourceRect(1, 1, 1 + random->bounded(48), 1 + random->bounded(48));
+            const QRect targetRect(3, 2, 1 + random->bounded(160), 1 + random->bounded(160));
+            const QImage source = randomImage(sourceRect.size() + QSize(2, 2), random);
+            QImage expected(targetRect.size() + QSize(5, 4), QImage::Format_ARGB32_Premultiplied);
+            expected.fill(0);
+            stretch(source, sourceRect, &expected, targetRect, quality, QImagineStretchPath::Scalar);
+
+            for (int i = 1; i < 3; ++i) {
+                if (!qImagineStretchPathSupported(stretchPaths[i].path))
+                    continue;
+                QImage result(expected.size(), QImage::Format_ARGB32_Premultiplied);
+                result.fill(0);
+                stretch(source, sourceRect, &result, targetRect, quality, stretchPaths[i].path);
+                if (result != expected)
+                    mismatches[i]++;
+            }
+        }
+
+        for (int i = 1; i < 3; ++i) {
+            const char *qualityName = quality == QImagineStretchQuality::Nearest ? "nearest" : "bilinear";
+            if (!qImagineStretchPathSupported(stretchPaths[i].path)) {
+                qDebug() << "stretch:" << stretchPaths[i].name << qualityName << "not supported here";
+                continue;
+            }
+            qDebug() << "stretch:" << stretchPaths[i].name << qualityName << "differs from scalar in"
+                     << mismatches[i] << "of" << rounds << "stretches";
+            same = same && !mismatches[i];
+        }
+    }
+    return same;
+}
+
+template <typename Stretch>
+qint64 nanosecondsPerStretch(int iterations, Stretch stretch)
+{
+    // Once untimed, so that first-use costs don't count
+    stretch();
+    QElapsedTimer timer;
+    timer.start();
+    for (int i = 0; i < iterations; ++i)
+        stretch();
+    return timer.nsecsElapsed() / iterations;
+}
+
+void timeCase(const QSize &sourceSize, const QSize &targetSize, int iterations, QRandomGenerator *random)
+{
+    const QImage source = randomImage(sourceSize + QSize(2, 2), random);
+    const QRect sourceRect(QPoint(1, 1), sourceSize);
+    QImage target(targetSize, QImage::Format_ARGB32_Premultiplied);
+    const QRect targetRect = target.rect();
+    QPainter painter(&target);
+
+    // How drawScaledPart() used to do it: copy the segment, scale the copy, and draw it
+    const auto scaled = [&](Qt::TransformationMode mode) {
+        return nanosecondsPerStretch(iterations, [&] {
+            painter.drawImage(targetRect.topLeft(), source.copy(sourceRect).scaled(targetSize, Qt::IgnoreAspectRatio, mode));
+        });
+    };
+    const qint64 fast = scaled(Qt::FastTransformation);
+    const qint64 smooth = scaled(Qt::SmoothTransformation);
+
+    QString line;
+    QDebug(&line).noquote().nospace() << sourceSize.width() << "x" << sourceSize.height() << " -> "
+                                      << targetSize.width() << "x" << targetSize.height() << ": scaled fast "
+                                      << fast << " ns, smooth " << smooth << " ns";
+    for (const auto &stretchPath : stretchPaths) {
+        if (!qImagineStretchPathSupported(stretchPath.path))
+            continue;
+        const qint64 nearest = nanosecondsPerStretch(iterations, [&] {
+            stretch(source, sourceRect, &target, targetRect, QImagineStretchQuality::Nearest, stretchPath.path);
+        });
+        const qint64 bilinear = nanosecondsPerStretch(iterations, [&] {
+            stretch(source, sourceRect, &target, targetRect, QImagineStretchQuality::Bilinear, stretchPath.path);
+        });
+        QDebug(&line).noquote().nospace() << "; " << stretchPath.name << " nearest " << nearest << " ns ("
+                                          << QString::number(qreal(fast) / qMax<qint64>(1, nearest), 'f', 1)
+                                          << "x), bilinear " << bilinear << " ns ("
+                                          << QString::number(qreal(fast) / qMax<qint64>(1, bilinear), 'f', 1) << "x)";
+    }
+    qDebug().noquote() << "stretch:" << line;
+}
+
+} // namespace
+
+bool runStretchBenchmark(int iterations)
+{
+    // A fixed seed, so that runs can be compared
+    QRandomGenerator random(1);
+    const bool same = comparePaths(&random);
+
+    // Speedups are against QImage::scaled() with the fast transformation, which was the old path
+    for (const auto &stretchCase : stretchCases)
+        timeCase(stretchCase.source, stretchCase.target, iterations, &random);
+    return same;
+}
@@ -0,0 +1,9 @@
+#ifndef STRETCHBENCHMARK_H
+#define STRETCHBENCHMARK_H
+
+// Checks that every code path of the stretch kernel that this build and CPU support gives the
+// same pixels as the scalar one, and times the kernel against the QImage::scaled() path that
+// nine-patch segments used to be stretched with. Returns false if a path gives other pixels.
+bool runStretchBenchmark(int iterations);
+
+#endif // STRETCHBENCHMARK_H
@@ -0,0 +1,366 @@
+#include "stretchkernel.h"
+
+#include <QVarLengthArray>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#  define IMAGINE_STRETCH_SSE2
+#  include <emmintrin.h>
+#endif
+
+// AVX2 is picked at runtime where the compiler lets us build it for a single function,
+// and otherwise only when the whole build already targets it.
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#  define IMAGINE_STRETCH_AVX2
+#  define IMAGINE_TARGET_AVX2 __attribute__((target("avx2")))
+#  include <immintrin.h>
+#elif defined(__AVX2__)
+#  define IMAGINE_STRETCH_AVX2
+#  define IMAGINE_TARGET_AVX2
+#  include <immintrin.h>
+#endif
+
+namespace {
+
+typedef void (*BlendRowsFunc)(const quint32 *a, const quint32 *b, quint32 *out, int count, uint weight);
+typedef void (*BilinearRowFunc)(const quint32 *row, const int *index0, const int *index1,
+                                const quint16 *weights, quint32 *out, int count);
+typedef void (*NearestRowFunc)(const quint32 *row, const int *index, quint32 *out, int count);
+
+struct StretchFunctions {
+    BlendRowsFunc blendRows;
+    BilinearRowFunc bilinearRow;
+    NearestRowFunc nearestRow;
+};
+
+// Weights are 0-255 for the second pixel, which keeps every product below 65536
+// so that all four channels can be interpolated in 16 bit lanes.
+inline quint32 interpolatePixel(quint32 x, uint a, quint32 y, uint b)
+{
+    quint32 t = (x & 0xff00ff) * a + (y & 0xff00ff) * b;
+    t = (t >> 8) & 0xff00ff;
+    x = ((x >> 8) & 0xff00ff) * a + ((y >> 8) & 0xff00ff) * b;
+    x &= 0xff00ff00;
+    return x | t;
+}
+
+void blendRowsScalar(const quint32 *a, const quint32 *b, quint32 *out, int count, uint weight)
+{
+    for (int i = 0; i < count; ++i)
+        out[i] = interpolatePixel(a[i], 256 - weight, b[i], weight);
+}
+
+void bilinearRowScalar(const quint32 *row, const int *index0, const int *index1,
+                       const quint16 *weights, quint32 *out, int count)
+{
+    for (int i = 0; i < count; ++i) {
+        const uint weight = weights[i * 4];
+        out[i] = interpolatePixel(row[index0[i]], 256 - weight, row[index1[i]], weight);
+    }
+}
+
+void nearestRowScalar(const quint32 *row, const int *index, quint32 *out, int count)
+{
+    for (int i = 0; i < count; ++i)
+        out[i] = row[index[i]];
+}
+
+#ifdef IMAGINE_STRETCH_SSE2
+void blendRowsSse2(const quint32 *a, const quint32 *b, quint32 *out, int count, uint weight)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i weightA = _mm_set1_epi16(short(256 - weight));
+    const __m128i weightB = _mm_set1_epi16(short(weight));
+
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        const __m128i pixelsA = _mm_loadu_si128(reinterpret_cast<const __m128i *>(a + i));
+        const __m128i pixelsB = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + i));
+        __m128i lo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(pixelsA, zero), weightA),
+                                   _mm_mullo_epi16(_mm_unpacklo_epi8(pixelsB, zero), weightB));
+        __m128i hi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(pixelsA, zero), weightA),
+                                   _mm_mullo_epi16(_mm_unpackhi_epi8(pixelsB, zero), weightB));
+        lo = _mm_srli_epi16(lo, 8);
+        hi = _mm_srli_epi16(hi, 8);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i), _mm_packus_epi16(lo, hi));
+    }
+    blendRowsScalar(a + i, b + i, out + i, count - i, weight);
+}
+
+void bilinearRowSse2(const quint32 *row, const int *index0, const int *index1,
+                     const quint16 *weights, quint32 *out, int count)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i full = _mm_set1_epi16(256);
+
+    int i = 0;
+    for (; i + 2 <= count; i += 2) {
+        const __m128i pixelsA = _mm_set_epi32(0, 0, int(row[index0[i + 1]]), int(row[index0[i]]));
+        const __m128i pixelsB = _mm_set_epi32(0, 0, int(row[index1[i + 1]]), int(row[index1[i]]));
+        const __m128i weightB = _mm_loadu_si128(reinterpret_cast<const __m128i *>(weights + i * 4));
+        const __m128i weightA = _mm_sub_epi16(full, weightB);
+        __m128i result = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(pixelsA, zero), weightA),
+                                       _mm_mullo_epi16(_mm_unpacklo_epi8(pixelsB, zero), weightB));
+        result = _mm_srli_epi16(result, 8);
+        _mm_storel_epi64(reinterpret_cast<__m128i *>(out + i), _mm_packus_epi16(result, zero));
+    }
+    bilinearRowScalar(row, index0 + i, index1 + i, weights + i * 4, out + i, count - i);
+}
+#endif
+
+#ifdef IMAGINE_STRETCH_AVX2
+IMAGINE_TARGET_AVX2
+void blendRowsAvx2(const quint32 *a, const quint32 *b, quint32 *out, int count, uint weight)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i weightA = _mm256_set1_epi16(short(256 - weight));
+    const __m256i weightB = _mm256_set1_epi16(short(weight));
+
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        // Unpacking and packing both work per 128 bit lane, so the pixel order is kept
+        const __m256i pixelsA = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(a + i));
+        const __m256i pixelsB = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(b + i));
+        __m256i lo = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpacklo_epi8(pixelsA, zero), weightA),
+                                      _mm256_mullo_epi16(_mm256_unpacklo_epi8(pixelsB, zero), weightB));
+        __m256i hi = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpackhi_epi8(pixelsA, zero), weightA),
+                                      _mm256_mullo_epi16(_mm256_unpackhi_epi8(pixelsB, zero), weightB));
+        lo = _mm256_srli_epi16(lo, 8);
+        hi = _mm256_srli_epi16(hi, 8);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + i), _mm256_packus_epi16(lo, hi));
+    }
+    blendRowsScalar(a + i, b + i, out + i, count - i, weight);
+}
+
+IMAGINE_TARGET_AVX2
+void bilinearRowAvx2(const quint32 *row, const int *index0, const int *index1,
+                     const quint16 *weights, quint32 *out, int count)
+{
+    const __m256i full = _mm256_set1_epi16(256);
+
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        // Plain loads measure faster than a gather for just four pixels
+        const __m128i pixelsA = _mm_set_epi32(int(row[index0[i + 3]]), int(row[index0[i + 2]]),
+                                              int(row[index0[i + 1]]), int(row[index0[i]]));
+        const __m128i pixelsB = _mm_set_epi32(int(row[index1[i + 3]]), int(row[index1[i + 2]]),
+                                              int(row[index1[i + 1]]), int(row[index1[i]]));
+        const __m256i weightB = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(weights + i * 4));
+        const __m256i weightA = _mm256_sub_epi16(full, weightB);
+        __m256i result = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_cvtepu8_epi16(pixelsA), weightA),
+                                          _mm256_mullo_epi16(_mm256_cvtepu8_epi16(pixelsB), weightB));
+        result = _mm256_srli_epi16(result, 8);
+        const __m128i packed = _mm_packus_epi16(_mm256_castsi256_si128(result),
+                                                _mm256_extracti128_si256(result, 1));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i), packed);
+    }
+    bilinearRowScalar(row, index0 + i, index1 + i, weights + i * 4, out + i, count - i);
+}
+
+IMAGINE_TARGET_AVX2
+void nearestRowAvx2(const quint32 *row, const int *index, quint32 *out, int count)
+{
+    const int *pixels = reinterpret_cast<const int *>(row);
+
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        const __m256i indexes = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(index + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + i), _mm256_i32gather_epi32(pixels, indexes, 4));
+    }
+    nearestRowScalar(row, index + i, out + i, count - i);
+}
+
+bool cpuHasAvx2()
+{
+#if defined(__GNUC__)
+    return __builtin_cpu_supports("avx2");
+#else
+    return true;
+#endif
+}
+#endif
+
+bool pathSupported(QImagineStretchPath path)
+{
+    switch (path) {
+    case QImagineStretchPath::Scalar:
+        return true;
+    case QImagineStretchPath::Sse2:
+#ifdef IMAGINE_STRETCH_SSE2
+        return true;
+#else
+        return false;
+#endif
+    case QImagineStretchPath::Avx2:
+#ifdef IMAGINE_STRETCH_AVX2
+        return cpuHasAvx2();
+#else
+        return false;
+#endif
+    }
+    return false;
+}
+
+// Each path builds on the one before it, since SSE2 has no gather for nearest sampling
+StretchFunctions pathFunctions(QImagineStretchPath path)
+{
+    StretchFunctions functions = { blendRowsScalar, bilinearRowScalar, nearestRowScalar };
+#ifdef IMAGINE_STRETCH_SSE2
+    if (path != QImagineStretchPath::Scalar) {
+        functions.blendRows = blendRowsSse2;
+        functions.bilinearRow = bilinearRowSse2;
+    }
+#endif
+#ifdef IMAGINE_STRETCH_AVX2
+    if (path == QImagineStretchPath::Avx2) {
+        functions.blendRows = blendRowsAvx2;
+        functions.bilinearRow = bilinearRowAvx2;
+        functions.nearestRow = nearestRowAvx2;
+    }
+#endif
+    return functions;
+}
+
+QImagineStretchPath fastestPath()
+{
+    if (pathSupported(QImagineStretchPath::Avx2))
+        return QImagineStretchPath::Avx2;
+    if (pathSupported(QImagineStretchPath::Sse2))
+        return QImagineStretchPath::Sse2;
+    return QImagineStretchPath::Scalar;
+}
+
+const StretchFunctions &stretchFunctions()
+{
+    static const StretchFunctions functions = pathFunctions(fastestPath());
+    return functions;
+}
+
+// Maps the center of each destination pixel to the source pixel it falls inside
+void setupNearest(int srcLength, int dstLength, int *index)
+{
+    for (int i = 0; i < dstLength; ++i)
+        index[i] = int(((2 * qint64(i) + 1) * srcLength) / (2 * qint64(dstLength)));
+}
+
+// Maps the center of each destination pixel to a position between two source pixel centers,
+// in 16.16 fixed point, and stores the two pixels together with the 8 bit weight of the second.
+// The weight is stored once per channel, so that the vector code can load it directly.
+void setupBilinear(int srcLength, int dstLength, int *index0, int *index1, quint16 *weights, int weightStride)
+{
+    const qint64 last = qint64(srcLength - 1) << 16;
+    for (int i = 0; i < dstLength; ++i) {
+        const qint64 center = (((2 * qint64(i) + 1) * srcLength) << 16) / (2 * qint64(dstLength)) - 0x8000;
+        const qint64 position = qBound(qint64(0), center, last);
+        index0[i] = int(position >> 16);
+        index1[i] = qMin(index0[i] + 1, srcLength - 1);
+        const quint16 weight = quint16((position & 0xffff) >> 8);
+        for (int channel = 0; channel < weightStride; ++channel)
+            weights[i * weightStride + channel] = weight;
+    }
+}
+
+inline const quint32 *constLine(const uchar *bits, int stride, int y)
+{
+    return reinterpret_cast<const quint32 *>(bits + qptrdiff(y) * stride);
+}
+
+inline quint32 *line(uchar *bits, int stride, int y)
+{
+    return reinterpret_cast<quint32 *>(bits + qptrdiff(y) * stride);
+}
+
+void stretchNearest(const uchar *src, int srcStride, int srcWidth, int srcHeight,
+                    uchar *dst, int dstStride, int dstWidth, int dstHeight,
+                    const StretchFunctions &functions)
+{
+    QVarLengthArray<int, 256> xIndex(dstWidth);
+    QVarLengthArray<int, 256> yIndex(dstHeight);
+    setupNearest(srcWidth, dstWidth, xIndex.data());
+    setupNearest(srcHeight, dstHeight, yIndex.data());
+
+    for (int y = 0; y < dstHeight; ++y) {
+        const quint32 *srcLine = constLine(src, srcStride, yIndex[y]);
+        quint32 *dstLine = line(dst, dstStride, y);
+        if (srcWidth == dstWidth)
+            memcpy(dstLine, srcLine, size_t(dstWidth) * 4);
+        else
+            functions.nearestRow(srcLine, xIndex.data(), dstLine, dstWidth);
+    }
+}
+
+void stretchBilinear(const uchar *src, int srcStride, int srcWidth, int srcHeight,
+                     uchar *dst, int dstStride, int dstWidth, int dstHeight,
+                     const StretchFunctions &functions)
+{
+    QVarLengthArray<int, 256> xIndex0(dstWidth);
+    QVarLengthArray<int, 256> xIndex1(dstWidth);
+    QVarLengthArray<quint16, 1024> xWeights(dstWidth * 4);
+    setupBilinear(srcWidth, dstWidth, xIndex0.data(), xIndex1.data(), xWeights.data(), 4);
+
+    QVarLengthArray<int, 256> yIndex0(dstHeight);
+    QVarLengthArray<int, 256> yIndex1(dstHeight);
+    QVarLengthArray<quint16, 256> yWeights(dstHeight);
+    setupBilinear(srcHeight, dstHeight, yIndex0.data(), yIndex1.data(), yWeights.data(), 1);
+
+    // Each destination line is made by first blending two source lines vertically, which
+    // is skipped when it lands exactly on a source line (always the case for a 1-D horizontal
+    // stretch), and then by interpolating horizontally, skipped for a 1-D vertical stretch.
+    QVarLengthArray<quint32, 256> blended(srcWidth);
+    int blendedIndex = -1;
+    uint blendedWeight = 0;
+
+    for (int y = 0; y < dstHeight; ++y) {
+        const uint weight = yWeights[y];
+        const quint32 *srcLine = constLine(src, srcStride, yIndex0[y]);
+        if (weight) {
+            if (blendedIndex != yIndex0[y] || blendedWeight != weight) {
+                functions.blendRows(srcLine, constLine(src, srcStride, yIndex1[y]), blended.data(), srcWidth, weight);
+                blendedIndex = yIndex0[y];
+                blendedWeight = weight;
+            }
+            srcLine = blended.constData();
+        }
+
+        quint32 *dstLine = line(dst, dstStride, y);
+        if (srcWidth == dstWidth)
+            memcpy(dstLine, srcLine, size_t(dstWidth) * 4);
+        else
+            functions.bilinearRow(srcLine, xIndex0.constData(), xIndex1.constData(), xWeights.constData(), dstLine, dstWidth);
+    }
+}
+
+void stretch(const uchar *src, int srcStride, int srcWidth, int srcHeight,
+             uchar *dst, int dstStride, int dstWidth, int dstHeight,
+             QImagineStretchQuality quality, const StretchFunctions &functions)
+{
+    if (srcWidth <= 0 || srcHeight <= 0 || dstWidth <= 0 || dstHeight <= 0)
+        return;
+
+    if (quality == QImagineStretchQuality::Nearest)
+        stretchNearest(src, srcStride, srcWidth, srcHeight, dst, dstStride, dstWidth, dstHeight, functions);
+    else
+        stretchBilinear(src, srcStride, srcWidth, srcHeight, dst, dstStride, dstWidth, dstHeight, functions);
+}
+
+} // namespace
+
+void qImagineStretch(const uchar *src, int srcStride, int srcWidth, int srcHeight,
+                     uchar *dst, int dstStride, int dstWidth, int dstHeight,
+                     QImagineStretchQuality quality)
+{
+    stretch(src, srcStride, srcWidth, srcHeight, dst, dstStride, dstWidth, dstHeight, quality, stretchFunctions());
+}
+
+bool qImagineStretchPathSupported(QImagineStretchPath path)
+{
+    return pathSupported(path);
+}
+
+void qImagineStretchWithPath(const uchar *src, int srcStride, int srcWidth, int srcHeight,
+                             uchar *dst, int dstStride, int dstWidth, int dstHeight,
+                             QImagineStretchQuality quality, QImagineStretchPath path)
+{
+    Q_ASSERT(pathSupported(path));
+    stretch(src, srcStride, srcWidth, srcHeight, dst, dstStride, dstWidth, dstHeight, quality, pathFunctions(path));
+}
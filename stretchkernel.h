@@ -0,0 +1,31 @@
+#pragma once
+
+#include <QtGlobal>
+
+enum class QImagineStretchQuality {
+    Nearest,
+    Bilinear
+};
+
+// Stretches an area of premultiplied ARGB32 pixels so that it fills another area. Both areas
+// are given by a pointer to their top-left pixel and the stride (bytes per line) of the image
+// they live in, so they can be sub-rects of larger images. Pixels are only ever sampled from
+// inside the source area, and the two areas must not overlap.
+void qImagineStretch(const uchar *src, int srcStride, int srcWidth, int srcHeight,
+                     uchar *dst, int dstStride, int dstWidth, int dstHeight,
+                     QImagineStretchQuality quality);
+
+// The code paths of the kernel. qImagineStretch() uses the fastest one that the build and the
+// CPU support; the others are there to check and time the paths against each other.
+enum class QImagineStretchPath {
+    Scalar,
+    Sse2,
+    Avx2
+};
+
+bool qImagineStretchPathSupported(QImagineStretchPath path);
+
+// Like qImagineStretch(), but with the given path, which has to be supported
+void qImagineStretchWithPath(const uchar *src, int srcStride, int srcWidth, int srcHeight,
+                             uchar *dst, int dstStride, int dstWidth, int dstHeight,
+                             QImagineStretchQuality quality, QImagineStretchPath path);